@@ -381,6 +381,7 @@ void log_analog_data() {
     unsigned long start = millis();
     unsigned long last_ms = start;
     struct dblog_write_context ctx;
+    memset(&ctx, '\0', sizeof(ctx));
     ctx.buf = buf;
     ctx.col_count = analog_pin_count + 1;
     ctx.page_resv_bytes = 0;
@@ -433,6 +434,7 @@ void locate_records(int8_t choice) {
   int dly;
   input_db_name();
   struct dblog_read_context rctx;
+  memset(&rctx, '\0', sizeof(rctx));
   rctx.page_size_exp = 9;
   rctx.read_fn = read_fn_rctx;
   myFile = fopen(filename, "r+b");
@@ -496,6 +498,7 @@ void locate_records(int8_t choice) {
 
 void recover_db() {
   struct dblog_write_context ctx;
+  memset(&ctx, '\0', sizeof(ctx));
   ctx.buf = buf;
   ctx.read_fn = read_fn_wctx;
   ctx.write_fn = write_fn;
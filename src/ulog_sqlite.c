@@ -29,14 +29,28 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#if DBLOG_CFG_WRITE_BEHIND && DBLOG_CFG_WRITE_BEHIND_PTHREAD
+#include <sched.h>
+#endif
 
 #define LEN_OF_REC_LEN 3
 #define LEN_OF_HDR_LEN 2
 #define CHKSUM_LEN 3
+#define KEY_DIR_HDR_LEN 8
 
 enum {DBLOG_ST_WRITE_NOT_PENDING = 0xA4, DBLOG_ST_WRITE_PENDING, 
         DBLOG_ST_TO_RECOVER, DBLOG_ST_FINAL};
 
+// tree_depth when interior pages could not be continued after reopening
+#define DBLOG_TREE_OFF 0xFF
+#define DBLOG_NO_PAGE 0xFFFFFFFF
+
+#define SLOT_MARK_LEN 8
+
+#define ZONE_HDR_LEN 2
+#define ZONE_LEN 28
+enum {DBLOG_SLOT_NONE = 0, DBLOG_SLOT_HOME, DBLOG_SLOT_SHADOW};
+
 // Returns how many bytes the given integer will
 // occupy if stored as a variable integer
 int8_t get_vlen_of_uint16(uint16_t vint) {
@@ -185,6 +199,53 @@ int32_t get_pagesize(byte page_size_exp) {
   return (int32_t) 1 << page_size_exp;
 }
 
+// Returns maximum no. of leaf pages after which they roll over
+// or 0 if there is no maximum
+uint32_t get_max_pages(byte max_pages_exp) {
+  return max_pages_exp ? (uint32_t) 1 << max_pages_exp : 0;
+}
+
+// Increments given leaf page no., rolling over
+// to first page if max_pages_exp is reached
+uint32_t next_leaf_page(uint32_t page_no, byte max_pages_exp) {
+  page_no++;
+  if (max_pages_exp && page_no > get_max_pages(max_pages_exp))
+    page_no = 1;
+  return page_no;
+}
+
+// Returns context of the first table, which allots pages
+// to all tables when there is more than one (see dblog_add_table())
+struct dblog_write_context *main_table(struct dblog_write_context *wctx) {
+#if DBLOG_CFG_MULTI_TABLE
+  return wctx->main_wctx ? wctx->main_wctx : wctx;
+#else
+  return wctx;
+#endif
+}
+
+// Returns 1 if the database has more than one table
+byte has_tables(struct dblog_write_context *wctx) {
+#if DBLOG_CFG_MULTI_TABLE
+  return main_table(wctx)->table_count > 1;
+#else
+  (void) wctx;
+  return 0;
+#endif
+}
+
+// Returns page where the leaf page after the current one is written,
+// which is the page after the last page used by any table if there
+// is more than one table
+uint32_t next_write_page(struct dblog_write_context *wctx) {
+#if DBLOG_CFG_MULTI_TABLE
+  struct dblog_write_context *main_wctx = main_table(wctx);
+  if (main_wctx->table_count > 1)
+    return ++main_wctx->last_page;
+#endif
+  return next_leaf_page(wctx->cur_write_page, wctx->max_pages_exp);
+}
+
 // Returns position of last record.
 // Creates one, if no record found.
 uint16_t acquire_last_pos(struct dblog_write_context *wctx, byte *ptr) {
@@ -277,21 +338,34 @@ uint32_t derive_col_type(int hdr_col_type_or_len) {
   return DBLOG_TYPE_TEXT; // error
 }
 
-byte c1, c2, c3;
-void saveChecksumBytes(byte * ptr, uint16_t last_pos) {
+// Reads integer of given column type (1 to 6, 8 or 9)
+// stored in big-endian sequence
+int64_t read_serial_int(const byte *ptr, uint32_t col_type) {
+  if (col_type >= 8)
+    return col_type - 8;
+  uint32_t len = dblog_derive_data_len(col_type);
+  int64_t ival = (int8_t) *ptr++;
+  while (--len)
+    ival = ival * 256 + *ptr++;
+  return ival;
+}
+
+// Saves the 3 bytes before last_pos into saved (no global state
+// so that several contexts can be used from different threads)
+void saveChecksumBytes(byte * ptr, uint16_t last_pos, byte *saved) {
   ptr += last_pos;
   ptr--;
-  c1 = *ptr--;
-  c2 = *ptr--;
-  c3 = *ptr;
+  saved[0] = *ptr--;
+  saved[1] = *ptr--;
+  saved[2] = *ptr;
 }
 
-void restoreChecksumBytes(byte * ptr, uint16_t last_pos) {
+void restoreChecksumBytes(byte * ptr, uint16_t last_pos, const byte *saved) {
   ptr += last_pos;
   ptr--;
-  *ptr-- = c1;
-  *ptr-- = c2;
-  *ptr = c3;
+  *ptr-- = saved[0];
+  *ptr-- = saved[1];
+  *ptr = saved[2];
 }
 
 // Initializes the buffer as a B-Tree Leaf table
@@ -340,6 +414,8 @@ int check_sums(byte *buf, int32_t page_size, int calc_or_check) {
   if (*buf == 5) // no need checksum for internal pages
     return DBLOG_RES_OK;
   if (*buf == 13) {
+    if (read_uint16(buf + 5) == 0) // no records, such as of a table
+      return DBLOG_RES_OK;         // to which no row was appended
     int8_t vlen;
     uint8_t chk_sum = 0;
     uint16_t i = 0;
@@ -409,6 +485,198 @@ int write_page(struct dblog_write_context *wctx, uint32_t page_no, int32_t page_
   return DBLOG_RES_OK;
 }
 
+// Writes given pages contiguously from page_no using writev_fn
+// if available, otherwise one by one using write_fn
+// Checksums are expected to be calculated already
+int write_pages(struct dblog_write_context *wctx, byte **bufs, byte buf_count,
+      uint32_t page_no, int32_t page_size) {
+  if (wctx->writev_fn && buf_count > 1) {
+    if ((wctx->writev_fn)(wctx, (void **) bufs, buf_count, page_no * page_size,
+            page_size) != page_size * buf_count)
+      return DBLOG_RES_WRITE_ERR;
+    return DBLOG_RES_OK;
+  }
+  for (byte i = 0; i < buf_count; i++) {
+    if ((wctx->write_fn)(wctx, bufs[i], (page_no + i) * page_size, page_size) != page_size)
+      return DBLOG_RES_WRITE_ERR;
+  }
+  return DBLOG_RES_OK;
+}
+
+#if DBLOG_CFG_WRITE_BEHIND
+
+// wb_completed is updated by dblog_write_complete(), which may be called
+// from an interrupt or another thread, so the counters are accessed
+// atomically, err_no being set before wb_completed is stored
+#define WB_LOAD(var) __atomic_load_n(&(var), __ATOMIC_ACQUIRE)
+#define WB_STORE(var, val) __atomic_store_n(&(var), (val), __ATOMIC_RELEASE)
+
+// Collects buffers of the oldest sealed pages waiting to be written
+// and returns their count along with the page number of the first
+// Only one page is returned unless writev_fn is available, in which
+// case all pending pages are returned, upto where pages roll over
+byte wb_oldest_pages(struct dblog_write_context *wctx, byte **bufs,
+      uint32_t *out_page_no) {
+  uint32_t max_pages = get_max_pages(wctx->max_pages_exp);
+  *out_page_no = wctx->cur_write_page - wctx->wb_pending;
+  if (wctx->cur_write_page <= wctx->wb_pending) // rolled over
+    *out_page_no += max_pages;
+  byte count = 0;
+  do {
+    bufs[count] = wctx->wb_bufs[(wctx->wb_cur + wctx->wb_buf_count
+                      - wctx->wb_pending + count) % wctx->wb_buf_count];
+    count++;
+  } while (wctx->writev_fn && count < wctx->wb_pending
+             && (!max_pages || *out_page_no + count <= max_pages));
+  return count;
+}
+
+// Writes the oldest sealed pages in the queue
+// Checksums are already calculated when the page is sealed
+int wb_write_oldest(struct dblog_write_context *wctx, int32_t page_size) {
+  uint32_t page_no;
+  byte *bufs[wctx->wb_buf_count];
+  byte count = wb_oldest_pages(wctx, bufs, &page_no);
+  int res = write_pages(wctx, bufs, count, page_no, page_size);
+  if (res)
+    return res;
+  wctx->wb_pending -= count;
+  return DBLOG_RES_OK;
+}
+
+#if DBLOG_CFG_WRITE_BEHIND_PTHREAD
+// Background worker that writes sealed pages in the order they were sealed
+// Write errors are recorded in err_no and reported on next seal or drain
+void *wb_worker(void *arg) {
+  struct dblog_write_context *wctx = (struct dblog_write_context *) arg;
+  int32_t page_size = get_pagesize(wctx->page_size_exp);
+  pthread_mutex_lock(&wctx->wb_mutex);
+  while (1) {
+    while (!wctx->wb_pending && wctx->wb_running)
+      pthread_cond_wait(&wctx->wb_cond, &wctx->wb_mutex);
+    if (!wctx->wb_pending)
+      break;
+    uint32_t page_no;
+    byte *bufs[wctx->wb_buf_count];
+    byte count = wb_oldest_pages(wctx, bufs, &page_no);
+    pthread_mutex_unlock(&wctx->wb_mutex);
+    int res = write_pages(wctx, bufs, count, page_no, page_size);
+    pthread_mutex_lock(&wctx->wb_mutex);
+    if (res && !wctx->err_no)
+      wctx->err_no = res;
+    wctx->wb_pending -= count;
+    pthread_cond_broadcast(&wctx->wb_cond);
+  }
+  pthread_mutex_unlock(&wctx->wb_mutex);
+  return NULL;
+}
+#endif
+
+// Makes buf part of the write-behind queue and starts the worker if any
+void wb_start(struct dblog_write_context *wctx) {
+  if (wctx->wb_buf_count < 2)
+    return;
+  wctx->wb_cur = 0;
+  while (wctx->wb_cur < wctx->wb_buf_count && wctx->wb_bufs[wctx->wb_cur] != wctx->buf)
+    wctx->wb_cur++;
+  if (wctx->wb_cur == wctx->wb_buf_count) {
+    wctx->wb_cur = 0;
+    memcpy(wctx->wb_bufs[0], wctx->buf, get_pagesize(wctx->page_size_exp));
+    wctx->buf = wctx->wb_bufs[0];
+  }
+  wctx->wb_pending = 0;
+  WB_STORE(wctx->wb_started, 0);
+  WB_STORE(wctx->wb_completed, 0);
+  wctx->err_no = 0;
+#if DBLOG_CFG_WRITE_BEHIND_PTHREAD
+  wctx->wb_running = 0;
+  if (wctx->write_async_fn || has_tables(wctx))
+    return; // write_async_fn, if any, does the work (see seal_page())
+  pthread_mutex_init(&wctx->wb_mutex, NULL);
+  pthread_cond_init(&wctx->wb_cond, NULL);
+  wctx->wb_running = 1;
+  if (pthread_create(&wctx->wb_thread, NULL, wb_worker, wctx)) {
+    // fall back to draining in the calling thread
+    wctx->wb_running = 0;
+    pthread_cond_destroy(&wctx->wb_cond);
+    pthread_mutex_destroy(&wctx->wb_mutex);
+  }
+#endif
+}
+
+// Returns no. of writes started by write_async_fn not yet complete
+byte wb_in_flight(struct dblog_write_context *wctx) {
+  return (byte) (WB_LOAD(wctx->wb_started) - WB_LOAD(wctx->wb_completed));
+}
+
+// Waits a while for writes started by write_async_fn to complete
+// using wait_fn if given, or yielding to other threads if available
+void wb_wait(struct dblog_write_context *wctx) {
+  if (wctx->wait_fn)
+    (wctx->wait_fn)(wctx);
+#if DBLOG_CFG_WRITE_BEHIND_PTHREAD
+  else
+    sched_yield();
+#endif
+}
+
+// See .h file for API description
+void dblog_write_complete(struct dblog_write_context *wctx, int32_t written) {
+  if (written != get_pagesize(wctx->page_size_exp) && !wctx->err_no)
+    wctx->err_no = DBLOG_RES_WRITE_ERR;
+  // only the caller of this updates wb_completed
+  WB_STORE(wctx->wb_completed, (byte) (wctx->wb_completed + 1));
+}
+
+// See .h file for API description
+int dblog_write_behind_drain(struct dblog_write_context *wctx, byte wait_all) {
+  if (wctx->wb_buf_count < 2)
+    return 0;
+  if (wctx->write_async_fn) {
+    while (wait_all && wb_in_flight(wctx))
+      wb_wait(wctx); // till dblog_write_complete()
+    return (wctx->err_no ? wctx->err_no : wb_in_flight(wctx));
+  }
+#if DBLOG_CFG_WRITE_BEHIND_PTHREAD
+  if (wctx->wb_running) {
+    pthread_mutex_lock(&wctx->wb_mutex);
+    while (wait_all && wctx->wb_pending)
+      pthread_cond_wait(&wctx->wb_cond, &wctx->wb_mutex);
+    int res = (wctx->err_no ? wctx->err_no : wctx->wb_pending);
+    pthread_mutex_unlock(&wctx->wb_mutex);
+    return res;
+  }
+#endif
+  int32_t page_size = get_pagesize(wctx->page_size_exp);
+  while (wctx->wb_pending) {
+    int res = wb_write_oldest(wctx, page_size);
+    if (res)
+      return res;
+    if (!wait_all)
+      break;
+  }
+  return wctx->wb_pending;
+}
+
+// See .h file for API description
+int dblog_write_behind_end(struct dblog_write_context *wctx) {
+  int res = dblog_write_behind_drain(wctx, 1);
+#if DBLOG_CFG_WRITE_BEHIND_PTHREAD
+  if (wctx->wb_buf_count > 1 && wctx->wb_running) {
+    pthread_mutex_lock(&wctx->wb_mutex);
+    wctx->wb_running = 0;
+    pthread_cond_broadcast(&wctx->wb_cond);
+    pthread_mutex_unlock(&wctx->wb_mutex);
+    pthread_join(wctx->wb_thread, NULL);
+    pthread_cond_destroy(&wctx->wb_cond);
+    pthread_mutex_destroy(&wctx->wb_mutex);
+  }
+#endif
+  return res;
+}
+
+#endif
+
 // Reads specified number of bytes from disk using the given callback function
 // for Write context
 int read_bytes_wctx(struct dblog_write_context *wctx, byte *buf, long pos, int32_t size) {
@@ -417,14 +685,326 @@ int read_bytes_wctx(struct dblog_write_context *wctx, byte *buf, long pos, int32
   return DBLOG_RES_OK;
 }
 
+#if DBLOG_CFG_MMAP
+// Returns pointer to given bytes if database is mapped into memory
+// or NULL if not available in the mapping
+// The mapping is not to be written to (see dblog_upd_col_val())
+byte *map_bytes_rctx(struct dblog_read_context *rctx, long pos, int32_t size) {
+  if (pos < 0 || pos + size > rctx->map_len)
+    return NULL;
+  return (byte *) rctx->map_base + pos;
+}
+#endif
+
 // Reads specified number of bytes from disk using the given callback function
-// for Read context
+// for Read context. Read from page cache if the page is available there
 int read_bytes_rctx(struct dblog_read_context *rctx, byte *buf, long pos, int32_t size) {
+#if DBLOG_CFG_MMAP
+  if (rctx->map_base) {
+    byte *src = map_bytes_rctx(rctx, pos, size);
+    if (src == NULL)
+      return DBLOG_RES_READ_ERR;
+    memcpy(buf, src, size);
+    return DBLOG_RES_OK;
+  }
+#endif
+#if DBLOG_CFG_PAGE_CACHE
+  if (rctx->cache_frame_count) {
+    int32_t page_size = get_pagesize(rctx->page_size_exp);
+    uint32_t page_no = pos / page_size;
+    int32_t offset = pos % page_size;
+    for (byte i = 0; offset + size <= page_size && i < rctx->cache_frame_count; i++) {
+      struct dblog_cache_frame *frame = rctx->cache_frames + i;
+      if (frame->page_no == page_no && frame->buf != buf) {
+        memcpy(buf, frame->buf + offset, size);
+        frame->last_used = ++rctx->cache_tick;
+        return DBLOG_RES_OK;
+      }
+    }
+  }
+#endif
+#if DBLOG_CFG_READ_AHEAD
+  if (rctx->ahead_count) {
+    int32_t page_size = get_pagesize(rctx->page_size_exp);
+    long ahead_pos = (long) rctx->ahead_page * page_size;
+    if (pos >= ahead_pos && pos + size <= ahead_pos + rctx->ahead_count * page_size) {
+      memcpy(buf, rctx->ahead_buf + pos - ahead_pos, size);
+      return DBLOG_RES_OK;
+    }
+  }
+#endif
   if ((rctx->read_fn)(rctx, buf, pos, size) != size)
     return DBLOG_RES_READ_ERR;
   return DBLOG_RES_OK;
 }
 
+#if DBLOG_CFG_READ_AHEAD
+// Returns no. of pages upto given count that can be read ahead
+// from given page without going past last leaf page or rolling over
+uint32_t pages_ahead(struct dblog_read_context *rctx, uint32_t page_no, uint32_t count) {
+  uint32_t max_pages = get_max_pages(rctx->max_pages_exp);
+  if (max_pages && page_no + count > max_pages + 1)
+    count = page_no > max_pages ? 0 : max_pages + 1 - page_no;
+  if (rctx->last_leaf_page >= page_no && page_no + count > rctx->last_leaf_page + 1)
+    count = rctx->last_leaf_page + 1 - page_no;
+  return count;
+}
+
+// Reads pages from current page into ahead_buf in one call
+// unless already there, and tells prefetch_fn about pages after them
+void read_ahead(struct dblog_read_context *rctx) {
+#if DBLOG_CFG_MMAP
+  if (rctx->map_base)
+    return;
+#endif
+  int32_t page_size = get_pagesize(rctx->page_size_exp);
+  uint32_t page_no = rctx->cur_page;
+  uint32_t next_page = page_no + 1;
+  if (rctx->ahead_buf) {
+    if (page_no >= rctx->ahead_page && page_no < rctx->ahead_page + rctx->ahead_count)
+      return;
+    rctx->ahead_page = page_no;
+    rctx->ahead_count = 0;
+    uint32_t count = pages_ahead(rctx, page_no, rctx->ahead_page_count);
+    int32_t read_len = (rctx->read_fn)(rctx, rctx->ahead_buf,
+                          page_no * page_size, count * page_size);
+    if (read_len > 0)
+      rctx->ahead_count = read_len / page_size; // may be short if not finalized
+    next_page = page_no + count;
+  }
+  if (rctx->prefetch_fn) {
+    uint32_t count = pages_ahead(rctx, next_page,
+                       rctx->ahead_page_count ? rctx->ahead_page_count : 1);
+    if (count)
+      (rctx->prefetch_fn)(rctx, next_page * page_size, count * page_size);
+  }
+}
+#endif
+
+#if DBLOG_CFG_PAGE_CACHE
+// Returns 1 if first frame is to be evicted before the second
+// Empty frames are used first, then leaf pages before interior
+// pages and then the least recently used
+byte evicts_before(struct dblog_cache_frame *frame1, struct dblog_cache_frame *frame2) {
+  if (frame1->page_no == DBLOG_NO_PAGE || frame2->page_no == DBLOG_NO_PAGE)
+    return frame1->page_no == DBLOG_NO_PAGE;
+  if ((frame1->buf[0] == 5) != (frame2->buf[0] == 5))
+    return frame2->buf[0] == 5;
+  return (int32_t) (frame1->last_used - frame2->last_used) < 0;
+}
+#endif
+
+// Returns pointer to given bytes in the mapping if database is mapped
+// into memory. Otherwise reads them into buf and returns buf
+byte *get_bytes_rctx(struct dblog_read_context *rctx, byte *buf, long pos,
+        int32_t size) {
+#if DBLOG_CFG_MMAP
+  if (rctx->map_base)
+    return map_bytes_rctx(rctx, pos, size);
+#endif
+  if (read_bytes_rctx(rctx, buf, pos, size))
+    return NULL;
+  return buf;
+}
+
+// Reads given page into buf, or if page cache is available,
+// makes buf point to the frame having the page, reading it if needed
+int read_page_rctx(struct dblog_read_context *rctx, uint32_t page_no, int32_t page_size) {
+#if DBLOG_CFG_MMAP
+  if (rctx->map_base) {
+    byte *page = map_bytes_rctx(rctx, (long) page_no * page_size, page_size);
+    if (page == NULL)
+      return DBLOG_RES_READ_ERR;
+    rctx->buf = page;
+    return DBLOG_RES_OK;
+  }
+#endif
+#if DBLOG_CFG_PAGE_CACHE
+  if (!rctx->cache_frame_count)
+    return read_bytes_rctx(rctx, rctx->buf, page_no * page_size, page_size);
+  struct dblog_cache_frame *victim = rctx->cache_frames;
+  for (byte i = 0; i < rctx->cache_frame_count; i++) {
+    struct dblog_cache_frame *frame = rctx->cache_frames + i;
+    if (frame->page_no == page_no) {
+      frame->last_used = ++rctx->cache_tick;
+      rctx->buf = frame->buf;
+      return DBLOG_RES_OK;
+    }
+    if (evicts_before(frame, victim))
+      victim = frame;
+  }
+  victim->page_no = DBLOG_NO_PAGE;
+  rctx->buf = victim->buf;
+  int res = read_bytes_rctx(rctx, victim->buf, page_no * page_size, page_size);
+  if (res)
+    return res;
+  victim->page_no = page_no;
+  victim->last_used = ++rctx->cache_tick;
+  return DBLOG_RES_OK;
+#else
+  return read_bytes_rctx(rctx, rctx->buf, page_no * page_size, page_size);
+#endif
+}
+
+// Writes free list trunk pages listing count pages from page_no
+// The last trunk page is linked to next_trunk (page no. starting
+// with 1 or 0 if none), such as the existing head of free list
+// See https://www.sqlite.org/fileformat.html#the_freelist
+int write_free_pages(struct dblog_write_context *wctx, uint32_t page_no,
+      uint32_t count, uint32_t next_trunk, int32_t page_size) {
+  uint32_t per_trunk = (page_size - wctx->page_resv_bytes) / 4 - 8;
+  uint32_t end = page_no + count;
+  while (page_no < end) {
+    uint32_t leaves = end - page_no - 1;
+    if (leaves > per_trunk)
+      leaves = per_trunk;
+    uint32_t trunk = page_no + 1 + leaves;
+    memset(wctx->buf, '\0', page_size);
+    write_uint32(wctx->buf, trunk < end ? trunk + 1 : next_trunk);
+    write_uint32(wctx->buf + 4, leaves);
+    for (uint32_t i = 0; i < leaves; i++)
+      write_uint32(wctx->buf + 8 + i * 4, page_no + 2 + i);
+    if ((wctx->write_fn)(wctx, wctx->buf, page_no * page_size, page_size) != page_size)
+      return DBLOG_RES_WRITE_ERR;
+    page_no = trunk;
+  }
+  return DBLOG_RES_OK;
+}
+
+// Puts count pages from page_no at the head of free list, given
+// first page in buf, extending page count if they are after it
+// First page is updated in buf and written
+int free_page_range(struct dblog_write_context *wctx, uint32_t page_no,
+      uint32_t count, int32_t page_size) {
+  uint32_t page_count = read_uint32(wctx->buf + 28);
+  uint32_t free_trunk = read_uint32(wctx->buf + 32);
+  uint32_t free_total = read_uint32(wctx->buf + 36);
+  int res = write_page(wctx, 0, page_size);
+  if (!res)
+    res = write_free_pages(wctx, page_no, count, free_trunk, page_size);
+  if (!res)
+    res = read_bytes_wctx(wctx, wctx->buf, 0, page_size);
+  if (res)
+    return res;
+  if (page_no + count > page_count)
+    write_uint32(wctx->buf + 28, page_no + count); // update page_count
+  write_uint32(wctx->buf + 32, page_no + 1);
+  write_uint32(wctx->buf + 36, free_total + count);
+  return write_page(wctx, 0, page_size);
+}
+
+#if DBLOG_CFG_FLUSH_SLOTS
+
+// Returns 1 if current page is to be flushed alternately in two slots
+byte uses_flush_slots(struct dblog_write_context *wctx) {
+  return wctx->page_resv_bytes >= SLOT_MARK_LEN && !has_tables(wctx);
+}
+
+// Returns the second slot where given page is written alternately
+// Next page is not used for rolling logs as it could have oldest rows
+uint32_t shadow_page(struct dblog_write_context *wctx, uint32_t page_no) {
+  if (wctx->max_pages_exp)
+    return get_max_pages(wctx->max_pages_exp) + 1;
+  return page_no + 1;
+}
+
+// Marks current page with its page no. and the next sequence no.
+void set_slot_mark(struct dblog_write_context *wctx, int32_t page_size) {
+  byte *mark = wctx->buf + page_size - wctx->page_resv_bytes;
+  write_uint32(mark, wctx->cur_write_page);
+  write_uint32(mark + 4, ++wctx->flush_seq);
+}
+
+// Writes current page with the next sequence no. at given page
+int write_slot(struct dblog_write_context *wctx, uint32_t page_no,
+      int32_t page_size) {
+  set_slot_mark(wctx, page_size);
+  return write_page(wctx, page_no, page_size);
+}
+
+// Writes current page in place, first writing it at the second slot
+// if the last good copy is in place
+int commit_slot(struct dblog_write_context *wctx, int32_t page_size) {
+  int res;
+  if (wctx->flush_slot == DBLOG_SLOT_HOME) {
+    res = write_slot(wctx, shadow_page(wctx, wctx->cur_write_page), page_size);
+    if (res)
+      return res;
+  }
+  res = write_slot(wctx, wctx->cur_write_page, page_size);
+  if (res)
+    return res;
+  wctx->flush_slot = DBLOG_SLOT_HOME;
+  return DBLOG_RES_OK;
+}
+
+// Reads the given copy of the current page into buf and returns
+// its sequence no. in out_seq if it is valid
+int read_slot(struct dblog_write_context *wctx, uint32_t page_no,
+      int32_t page_size, uint32_t *out_seq) {
+  int res = read_bytes_wctx(wctx, wctx->buf, page_no * page_size, page_size);
+  if (res)
+    return res;
+  byte *mark = wctx->buf + page_size - wctx->page_resv_bytes;
+  if (wctx->buf[0] != 13 || read_uint32(mark) != wctx->cur_write_page)
+    return DBLOG_RES_NOT_FOUND;
+  if (check_sums(wctx->buf, page_size, 3))
+    return DBLOG_RES_INV_CHKSUM;
+  *out_seq = read_uint32(mark + 4);
+  return DBLOG_RES_OK;
+}
+
+// Finds the last page written before power failure from the last
+// leaf page found and writes the latest good copy of it in place
+// Uses buf
+int recover_slot(struct dblog_write_context *wctx, int32_t page_size) {
+  uint32_t seq, shadow_seq;
+  uint32_t page_no = wctx->cur_write_page;
+  // the last leaf found could be the second slot of previous page
+  if (!wctx->max_pages_exp && page_no > 1) {
+    wctx->cur_write_page = page_no - 1;
+    int res = read_slot(wctx, page_no, page_size, &seq);
+    if (res && res != DBLOG_RES_INV_CHKSUM) // even if torn
+      wctx->cur_write_page = page_no;
+  }
+  // or the last page could be torn so as to be not found as a leaf
+  if (wctx->cur_write_page == page_no) {
+    wctx->cur_write_page = next_leaf_page(page_no, wctx->max_pages_exp);
+    if (read_slot(wctx, shadow_page(wctx, wctx->cur_write_page), page_size, &seq))
+      wctx->cur_write_page = page_no;
+  }
+  byte home_ok = !read_slot(wctx, wctx->cur_write_page, page_size, &seq);
+  if (read_slot(wctx, shadow_page(wctx, wctx->cur_write_page), page_size, &shadow_seq)) {
+    // no good copy, such as when first write of a page is torn
+    if (!home_ok && wctx->cur_write_page > 1)
+      wctx->cur_write_page--;
+    else if (!home_ok && wctx->max_pages_exp && wctx->cur_write_page == 1)
+      wctx->cur_write_page = get_max_pages(wctx->max_pages_exp);
+    return DBLOG_RES_OK;
+  }
+  if (home_ok && (int32_t) (shadow_seq - seq) < 0)
+    return DBLOG_RES_OK;
+  return write_page(wctx, wctx->cur_write_page, page_size);
+}
+
+// Puts pages from page count upto second slot of last leaf page on
+// free list if it was written, so that Sqlite does not find it unused
+// It is the page after the last leaf page (or after max pages for
+// rolling logs), which is otherwise overwritten by interior pages
+// Expects first page in buf
+int free_shadow_page(struct dblog_write_context *wctx, int32_t page_size) {
+  if (!uses_flush_slots(wctx))
+    return DBLOG_RES_OK;
+  uint32_t page_count = read_uint32(wctx->buf + 28);
+  uint32_t shadow = shadow_page(wctx, wctx->cur_write_page);
+  byte head_buf[1];
+  if (shadow < page_count || read_bytes_wctx(wctx, head_buf, shadow * page_size, 1))
+    return DBLOG_RES_OK; // within tree or not written
+  return free_page_range(wctx, page_count, shadow + 1 - page_count, page_size);
+}
+
+#endif
+
 // Adds record to B-Tree inner table
 int add_rec_to_inner_tbl(struct dblog_write_context *wctx, byte *parent_buf, 
       uint32_t rowid, uint32_t cur_level_pos) {
@@ -435,7 +1015,7 @@ int add_rec_to_inner_tbl(struct dblog_write_context *wctx, byte *parent_buf,
   byte rec_len = 4 + get_vlen_of_uint32(rowid);
 
   if (last_pos == 0)
-    last_pos = page_size - rec_len;
+    last_pos = page_size - wctx->page_resv_bytes - rec_len;
   else {
     // 3 is for checksum
     if (last_pos - rec_len < 12 + rec_count * 2 + get_vlen_of_uint32(rowid) + 3)
@@ -463,105 +1043,604 @@ int add_rec_to_inner_tbl(struct dblog_write_context *wctx, byte *parent_buf,
 
 }
 
-const char sqlite_sig[] = "SQLite format 3";
-const char dblog_sig[]  = "SQLite3 uLogger";
-char default_table_name[] = "t1";
+// Removes last row of B-Tree inner table and writes its child
+// as right most pointer, keeping its rowid after the cell pointers
+// as the last rowid of the page (see get_last_rowid())
+void remove_last_inner_rec(byte *buf) {
+  uint16_t rec_count = read_uint16(buf + 3) - 1;
+  uint16_t last_pos = read_uint16(buf + 12 + rec_count * 2);
+  int8_t vint_len;
+  uint32_t rowid = read_vint32(buf + last_pos + 4, &vint_len);
+  memcpy(buf + 8, buf + last_pos, 4);
+  write_vint32(buf + 12 + rec_count * 2, rowid);
+  write_uint16(buf + 3, rec_count);
+  write_uint16(buf + 5, rec_count ? read_uint16(buf + 12 + (rec_count - 1) * 2) : 0);
+}
 
-// Writes data into buffer to form first page of Sqlite db
-int form_page1(struct dblog_write_context *wctx, char *table_name, char *table_script) {
+#if DBLOG_CFG_STREAM_BTREE
 
-  if (wctx->page_size_exp < 9 || wctx->page_size_exp > 16)
-    return DBLOG_RES_INV_PAGE_SZ;
-  byte *buf = (byte *) wctx->buf;
-  int32_t page_size = get_pagesize(wctx->page_size_exp);
-  wctx->cur_write_rowid = 0;
+// Writes given interior page at given position
+int write_tree_page(struct dblog_write_context *wctx, byte *buf,
+      uint32_t page_no, int32_t page_size) {
+  if ((wctx->write_fn)(wctx, buf, page_no * page_size, page_size) != page_size)
+    return DBLOG_RES_WRITE_ERR;
+  return DBLOG_RES_OK;
+}
 
-  // 100 byte header - refer https://www.sqlite.org/fileformat.html
-  memcpy(buf, dblog_sig, 16);
-  //memcpy(buf, "SQLite format 3\0", 16);
-  write_uint16(buf + 16, page_size == 65536 ? 1 : (uint16_t) page_size);
-  buf[18] = 1;
-  buf[19] = 1;
-  buf[20] = wctx->page_resv_bytes;
-  buf[21] = 64;
-  buf[22] = 32;
-  buf[23] = 32;
-  //write_uint32(buf + 24, 0);
-  //write_uint32(buf + 28, 0);
-  //write_uint32(buf + 32, 0);
-  //write_uint32(buf + 36, 0);
-  //write_uint32(buf + 40, 0);
-  memset(buf + 24, '\0', 20); // Set to zero, above 5
-  write_uint32(buf + 28, 2); // TODO: Update during finalize
-  write_uint32(buf + 44, 4);
-  //write_uint16(buf + 48, 0);
-  //write_uint16(buf + 52, 0);
-  memset(buf + 48, '\0', 8); // Set to zero, above 2
-  write_uint32(buf + 56, 1);
-  // User version initially 0, set to table leaf count
-  // used to locate last leaf page for binary search
-  // and move to last page.
-  write_uint32(buf + 60, 0);
-  write_uint32(buf + 64, 0);
-  // App ID - set to 0xA5xxxxxx where A5 is signature
-  // last 5 bits = wctx->max_pages_exp - set to 0 currently
-  // till it is implemented
-  write_uint32(buf + 68, 0xA5000000);
-  memset(buf + 72, '\0', 20); // reserved space
-  write_uint32(buf + 92, 105);
-  write_uint32(buf + 96, 3016000);
-  memset(buf + 100, '\0', page_size - 100); // Set remaing page to zero
+// Adds given child page to the interior page of each level
+// starting at the lowest, as long as the page becomes full.
+// Full pages are written at cur_write_page, that is, next to the child
+int add_to_tree(struct dblog_write_context *wctx, uint32_t child_page,
+      uint32_t rowid, int32_t page_size) {
+  for (byte level = 0; ; level++) {
+    byte *level_buf = wctx->tree_buf + level * page_size;
+    if (level == wctx->tree_depth) {
+      if (level == wctx->tree_levels)
+        return DBLOG_RES_TOO_LONG;
+      init_bt_tbl_inner(level_buf);
+      wctx->tree_depth++;
+    }
+    if (!add_rec_to_inner_tbl(wctx, level_buf, rowid, child_page))
+      return DBLOG_RES_OK;
+    int res;
+#if DBLOG_CFG_WRITE_BEHIND
+    // page numbers of queued pages are derived from cur_write_page
+    res = dblog_write_behind_drain(wctx, 1);
+    if (res)
+      return res;
+#endif
+    res = write_tree_page(wctx, level_buf, wctx->cur_write_page, page_size);
+    if (res)
+      return res;
+    child_page = wctx->cur_write_page++;
+    init_bt_tbl_inner(level_buf);
+  }
+  return DBLOG_RES_OK;
+}
 
-  // master table b-tree
-  init_bt_tbl_leaf(buf + 100);
+// Returns 1 if interior pages have been formed during append
+// and can be completed using flush_tree()
+byte is_tree_streamed(struct dblog_write_context *wctx) {
+  return wctx->state != DBLOG_ST_TO_RECOVER && wctx->tree_levels
+           && wctx->tree_depth != DBLOG_TREE_OFF && !wctx->max_pages_exp;
+}
 
-  // write table script record
-  int orig_col_count = wctx->col_count;
-  wctx->cur_write_page = 0;
-  wctx->col_count = 5;
-  dblog_append_empty_row(wctx);
-  dblog_set_col_val(wctx, 0, DBLOG_TYPE_TEXT, "table", 5);
-  if (table_name == NULL)
-    table_name = default_table_name;
-  dblog_set_col_val(wctx, 1, DBLOG_TYPE_TEXT, table_name, strlen(table_name));
-  dblog_set_col_val(wctx, 2, DBLOG_TYPE_TEXT, table_name, strlen(table_name));
-  int32_t root_page = 2;
-  dblog_set_col_val(wctx, 3, DBLOG_TYPE_INT, &root_page, 4);
-  if (table_script) {
-    uint16_t script_len = strlen(table_script);
-    if (script_len > page_size - 100 - wctx->page_resv_bytes - 8 - 10)
-      return DBLOG_RES_TOO_LONG;
-    dblog_set_col_val(wctx, 4, DBLOG_TYPE_TEXT, table_script, script_len);
-  } else {
-    int table_name_len = strlen(table_name);
-    int script_len = (13 + table_name_len + 2 + 5 * orig_col_count);
-    if (script_len > page_size - 100 - wctx->page_resv_bytes - 8 - 10)
+// Writes the interior page of each level with the last leaf
+// as the right most child and returns the root page
+int flush_tree(struct dblog_write_context *wctx, uint32_t *out_root_page,
+      int32_t page_size) {
+  uint32_t child_page = wctx->cur_write_page;
+  uint32_t next_page = wctx->cur_write_page + 1;
+  uint32_t rowid = wctx->cur_write_rowid;
+  byte *level_bufs[wctx->tree_levels];
+  for (byte level = 0; level < wctx->tree_depth; level++) {
+    byte *level_buf = wctx->tree_buf + level * page_size;
+    if (!add_rec_to_inner_tbl(wctx, level_buf, rowid, child_page)) {
+      // remove last row and write as right most pointer
+      uint16_t rec_count = read_uint16(level_buf + 3) - 1;
+      write_uint32(level_buf + 8, child_page + 1);
+      write_vint32(level_buf + 12 + rec_count * 2, rowid);
+      write_uint16(level_buf + 3, rec_count);
+      write_uint16(level_buf + 5, rec_count ?
+            read_uint16(level_buf + 12 + (rec_count - 1) * 2) : 0);
+    }
+    level_bufs[level] = level_buf;
+    child_page = next_page++;
+  }
+  // pages of all levels are contiguous after the last leaf
+  if (wctx->tree_depth) {
+    int res = write_pages(wctx, level_bufs, wctx->tree_depth,
+                  wctx->cur_write_page + 1, page_size);
+    if (res)
+      return res;
+  }
+  *out_root_page = child_page;
+  return DBLOG_RES_OK;
+}
+
+// Loads the interior pages on the right most path written by finalize
+// so that interior pages can continue to be formed after reopening
+// The right most child of each level is dropped as it would be
+// added again when the page below is sealed
+// Returns DBLOG_RES_NOT_FOUND if the tree was not formed this way
+// (such as by an earlier finalize without DBLOG_CFG_STREAM_BTREE)
+int load_tree(struct dblog_write_context *wctx, uint32_t root_page,
+      int32_t page_size) {
+  wctx->tree_depth = 0;
+  byte head_buf[12];
+  int res = read_bytes_wctx(wctx, head_buf, root_page * page_size, 12);
+  if (res)
+    return res;
+  byte depth = 0;
+  uint32_t page_no = root_page;
+  while (head_buf[0] == 5) {
+    if (depth == wctx->tree_levels)
       return DBLOG_RES_TOO_LONG;
-    dblog_set_col_val(wctx, 4, DBLOG_TYPE_TEXT, buf + 110, script_len);
-    byte *script_pos = buf + page_size - buf[20] - script_len;
-    memcpy(script_pos, "CREATE TABLE ", 13);
-    script_pos += 13;
-    memcpy(script_pos, table_name, table_name_len);
-    script_pos += table_name_len;
-    *script_pos++ = ' ';
-    *script_pos++ = '(';
-    for (int i = 0; i < orig_col_count; ) {
-      i++;
-      *script_pos++ = 'c';
-      *script_pos++ = '0' + (i < 100 ? 0 : (i / 100));
-      *script_pos++ = '0' + (i < 10 ? 0 : ((i < 100 ? i : i - 100) / 10));
-      *script_pos++ = '0' + (i % 10);
-      *script_pos++ = (i == orig_col_count ? ')' : ',');
+    depth++;
+    page_no = read_uint32(head_buf + 8) - 1;
+    res = read_bytes_wctx(wctx, head_buf, page_no * page_size, 12);
+    if (res)
+      return res;
+  }
+  if (page_no != wctx->cur_write_page)
+    return DBLOG_RES_NOT_FOUND; // last leaf not in tree (partially finalized)
+  page_no = root_page;
+  for (byte level = depth; level--; ) {
+    byte *level_buf = wctx->tree_buf + level * page_size;
+    res = read_bytes_wctx(wctx, level_buf, page_no * page_size, page_size);
+    if (res)
+      return res;
+    page_no = read_uint32(level_buf + 8) - 1;
+    write_uint32(level_buf + 8, 0);
+    // Full pages of lower levels should be before the last leaf
+    // and not after, as they would be overwritten by new leaves
+    uint16_t rec_count = read_uint16(level_buf + 3);
+    for (uint16_t i = 0; level && i < rec_count; i++) {
+      if (read_uint32(level_buf + read_uint16(level_buf + 12 + i * 2)) - 1
+            >= wctx->cur_write_page)
+        return DBLOG_RES_NOT_FOUND;
     }
   }
+  wctx->tree_depth = depth;
+  return DBLOG_RES_OK;
+}
+
+// Returns 1 if interior pages formed during append may be left
+// among the leaf pages, not being part of the tree formed by finalize
+byte may_have_stray_pages(struct dblog_write_context *wctx) {
+  return wctx->state == DBLOG_ST_TO_RECOVER || wctx->tree_depth == DBLOG_TREE_OFF;
+}
+
+// Puts interior pages found among leaf_count leaf pages on the
+// free list, listing them in trunk pages added after the last page
+// Expects first page in buf, which is updated and written
+int free_stray_pages(struct dblog_write_context *wctx, uint32_t leaf_count,
+      int32_t page_size) {
+  uint32_t page_count = read_uint32(wctx->buf + 28);
+  uint32_t free_trunk = read_uint32(wctx->buf + 32);
+  uint32_t free_total = read_uint32(wctx->buf + 36);
   int res = write_page(wctx, 0, page_size);
   if (res)
     return res;
+  uint32_t per_trunk = (page_size - wctx->page_resv_bytes) / 4 - 8;
+  uint32_t trunk = page_count;
+  uint32_t leaves = 0;
+  for (uint32_t page_no = 1; page_no <= leaf_count + 1; page_no++) {
+    byte page_type = 0;
+    if (page_no <= leaf_count) {
+      res = read_bytes_wctx(wctx, &page_type, page_no * page_size, 1);
+      if (res)
+        return res;
+      if (page_type != 5)
+        continue;
+    }
+    if (leaves && (leaves == per_trunk || page_no > leaf_count)) {
+      memset(wctx->buf + leaves * 4 + 8, '\0', page_size - leaves * 4 - 8);
+      write_uint32(wctx->buf, free_trunk);
+      write_uint32(wctx->buf + 4, leaves);
+      if ((wctx->write_fn)(wctx, wctx->buf, trunk * page_size, page_size) != page_size)
+        return DBLOG_RES_WRITE_ERR;
+      free_total += leaves + 1;
+      free_trunk = ++trunk;
+      leaves = 0;
+    }
+    if (page_type == 5)
+      write_uint32(wctx->buf + 8 + leaves++ * 4, page_no + 1);
+  }
+  res = read_bytes_wctx(wctx, wctx->buf, 0, page_size);
+  if (res || trunk == page_count)
+    return res;
+  write_uint32(wctx->buf + 28, trunk); // update page_count
+  write_uint32(wctx->buf + 32, free_trunk);
+  write_uint32(wctx->buf + 36, free_total);
+  return write_page(wctx, 0, page_size);
+}
+
+#endif
+
+// Seals the current page so that the next page can be started in buf
+// Without write-behind, the page is written immediately.
+// With write-behind, it is queued and buf points to next free buffer
+int seal_page(struct dblog_write_context *wctx, int32_t page_size) {
+  wctx->flushed_rec_count = 0;
+#if DBLOG_CFG_FLUSH_SLOTS
+  if (uses_flush_slots(wctx)) {
+    if (wctx->flush_slot == DBLOG_SLOT_HOME) {
+      // last good copy is in place, so it is written in second slot first
+      int res = write_slot(wctx, shadow_page(wctx, wctx->cur_write_page), page_size);
+      if (res)
+        return res;
+    }
+    set_slot_mark(wctx, page_size);
+    wctx->flush_slot = DBLOG_SLOT_NONE;
+  }
+#endif
+#if DBLOG_CFG_WRITE_BEHIND
+  // pages in queue are taken to be contiguous, which they are not
+  // when there is more than one table, but async writes are given pages
+  if (wctx->wb_buf_count > 1 && (wctx->write_async_fn || !has_tables(wctx))) {
+    int res = DBLOG_RES_OK;
+    check_sums(wctx->buf, page_size, 0);
+    if (wctx->write_async_fn) {
+      if ((wctx->write_async_fn)(wctx, wctx->buf,
+              wctx->cur_write_page * page_size, page_size))
+        return DBLOG_RES_WRITE_ERR;
+      WB_STORE(wctx->wb_started, (byte) (wctx->wb_started + 1));
+      wctx->cur_write_page = next_write_page(wctx);
+      wctx->wb_cur = (wctx->wb_cur + 1) % wctx->wb_buf_count;
+      while (wb_in_flight(wctx) == wctx->wb_buf_count)
+        wb_wait(wctx); // till next buffer is written
+      wctx->buf = wctx->wb_bufs[wctx->wb_cur];
+      return wctx->err_no;
+    }
+#if DBLOG_CFG_WRITE_BEHIND_PTHREAD
+    if (wctx->wb_running) {
+      pthread_mutex_lock(&wctx->wb_mutex);
+      wctx->wb_pending++;
+      wctx->cur_write_page = next_write_page(wctx);
+      wctx->wb_cur = (wctx->wb_cur + 1) % wctx->wb_buf_count;
+      pthread_cond_broadcast(&wctx->wb_cond);
+      while (wctx->wb_pending == wctx->wb_buf_count)
+        pthread_cond_wait(&wctx->wb_cond, &wctx->wb_mutex);
+      wctx->buf = wctx->wb_bufs[wctx->wb_cur];
+      res = wctx->err_no;
+      pthread_mutex_unlock(&wctx->wb_mutex);
+      return res;
+    }
+#endif
+    uint32_t sealed_page = wctx->cur_write_page;
+    wctx->wb_pending++;
+    wctx->cur_write_page = next_write_page(wctx);
+    wctx->wb_cur = (wctx->wb_cur + 1) % wctx->wb_buf_count;
+    if (wctx->wb_pending == wctx->wb_buf_count)
+      res = wb_write_oldest(wctx, page_size);
+    if (res) {
+      wctx->wb_pending--;
+      wctx->cur_write_page = sealed_page;
+      wctx->wb_cur = (wctx->wb_cur + wctx->wb_buf_count - 1) % wctx->wb_buf_count;
+      return res;
+    }
+    wctx->buf = wctx->wb_bufs[wctx->wb_cur];
+    return DBLOG_RES_OK;
+  }
+#endif
+  int res = write_page(wctx, wctx->cur_write_page, page_size);
+  if (res)
+    return res;
+  wctx->cur_write_page = next_write_page(wctx);
+  return DBLOG_RES_OK;
+}
+
+#if DBLOG_CFG_PAGE_LAYOUT
+// Returns leaf page having given rowid if leaf pages
+// from layout_page have layout_rows rows each
+uint32_t layout_page_of(uint32_t rowid, uint32_t layout_page,
+      uint32_t layout_rowid, uint16_t layout_rows, byte max_pages_exp) {
+  uint32_t page_no = layout_page + (rowid - layout_rowid) / layout_rows;
+  if (max_pages_exp)
+    page_no = (page_no - 1) % get_max_pages(max_pages_exp) + 1;
+  return page_no;
+}
+
+// Tracks whether leaf pages being sealed have the same no. of rows,
+// starting again from the page being sealed when not
+void track_layout(struct dblog_write_context *wctx) {
+  if (has_tables(wctx))
+    return; // leaf pages of a table are not contiguous
+  uint16_t rec_count = read_uint16(wctx->buf + 3);
+  int8_t vlen;
+  uint32_t first_rowid = read_vint32(wctx->buf
+          + read_uint16(wctx->buf + 8) + LEN_OF_REC_LEN, &vlen);
+  if (wctx->layout_rows && wctx->layout_rows == rec_count && wctx->cur_write_page
+        == layout_page_of(first_rowid, wctx->layout_page, wctx->layout_rowid,
+                           wctx->layout_rows, wctx->max_pages_exp))
+    return;
+  wctx->layout_page = wctx->cur_write_page;
+  wctx->layout_rowid = first_rowid;
+  wctx->layout_rows = rec_count;
+}
+#endif
+
+// Returns length of zone maps kept at the end of reserved bytes
+// of leaf pages, which is a row count followed by zone_col_count
+// entries of column index, REAL flag, value count, min, max and sum
+uint16_t zone_area_len(byte zone_col_count) {
+  return zone_col_count ? ZONE_HDR_LEN + zone_col_count * ZONE_LEN : 0;
+}
+
+// Returns position of the reserved byte before zone maps, in which
+// leaf pages are marked with their table when there is more than one
+uint16_t table_mark_pos(int32_t page_size, byte zone_col_count) {
+  return page_size - zone_area_len(zone_col_count) - 1;
+}
+
+#if DBLOG_CFG_MULTI_TABLE
+// Marks the leaf page in buf with its table, if there is more than one
+void mark_table(struct dblog_write_context *wctx, int32_t page_size) {
+  if (has_tables(wctx))
+    wctx->buf[table_mark_pos(page_size, wctx->zone_col_count)] = wctx->table_idx;
+}
+#endif
+
+// Converts INT or REAL value read from a record to double
+// Returns 0 for other types
+byte num_of_rec_val(const byte *val_at, uint32_t col_type, double *out) {
+  if (col_type == 7) {
+    uint64_t bytes64 = read_uint64((byte *) val_at);
+    memcpy(out, &bytes64, 8);
+    return *out == *out; // not NaN
+  }
+  if (col_type == 0 || col_type > 9)
+    return 0;
+  *out = (double) read_serial_int(val_at, col_type);
+  return 1;
+}
+
+// Adds INT or REAL value read from a record to given summary
+// Other types are not counted
+void add_to_summary(struct dblog_summary *sum, const byte *val_at, uint32_t col_type) {
+  double dval;
+  if (!num_of_rec_val(val_at, col_type, &dval))
+    return;
+  if (col_type == 7)
+    sum->is_real = 1;
+  else {
+    int64_t ival = read_serial_int(val_at, col_type);
+    if (!sum->count || ival < sum->min_int)
+      sum->min_int = ival;
+    if (!sum->count || ival > sum->max_int)
+      sum->max_int = ival;
+    sum->sum_int = (int64_t) ((uint64_t) sum->sum_int + (uint64_t) ival);
+  }
+  if (!sum->count || dval < sum->min)
+    sum->min = dval;
+  if (!sum->count || dval > sum->max)
+    sum->max = dval;
+  sum->sum += dval;
+  sum->count++;
+}
+
+// Forms zone maps of given columns from the records of the leaf page
+// in buf. If cols is NULL, columns of the zone maps already there
+// are used. NULL, TEXT and BLOB values are not counted
+void write_zones(byte *buf, int32_t page_size, byte resv_bytes,
+      const byte *cols, byte col_count) {
+  uint16_t rec_count = read_uint16(buf + 3);
+  uint16_t page_end = page_size - resv_bytes;
+  byte *zone = buf + page_size - zone_area_len(col_count);
+  write_uint16(zone, rec_count);
+  zone += ZONE_HDR_LEN;
+  for (byte i = 0; i < col_count; i++) {
+    byte col_idx = cols ? cols[i] : zone[0];
+    struct dblog_summary sum;
+    memset(&sum, '\0', sizeof(sum));
+    for (uint16_t r = 0; r < rec_count; r++) {
+      uint16_t rec_pos = read_uint16(buf + 8 + r * 2);
+      byte *val_at;
+      uint16_t rec_len, hdr_len;
+      byte *hdr_ptr = locate_column(buf + rec_pos, col_idx, &val_at,
+                        &rec_len, &hdr_len, page_end - rec_pos);
+      if (hdr_ptr == NULL)
+        continue;
+      int8_t vlen;
+      add_to_summary(&sum, val_at, read_vint32(hdr_ptr, &vlen));
+    }
+    memset(zone, '\0', ZONE_LEN);
+    zone[0] = col_idx;
+    zone[1] = sum.is_real;
+    write_uint16(zone + 2, sum.count);
+    if (sum.is_real) {
+      uint64_t bytes64;
+      memcpy(&bytes64, &sum.min, 8);
+      write_uint64(zone + 4, bytes64);
+      memcpy(&bytes64, &sum.max, 8);
+      write_uint64(zone + 12, bytes64);
+      memcpy(&bytes64, &sum.sum, 8);
+      write_uint64(zone + 20, bytes64);
+    } else if (sum.count) {
+      write_uint64(zone + 4, (uint64_t) sum.min_int);
+      write_uint64(zone + 12, (uint64_t) sum.max_int);
+      write_uint64(zone + 20, (uint64_t) sum.sum_int);
+    }
+    zone += ZONE_LEN;
+  }
+}
+
+// Seals the current page and adds it to the interior pages, if formed
+int seal_leaf_page(struct dblog_write_context *wctx, int32_t page_size) {
+#if DBLOG_CFG_PAGE_LAYOUT
+  track_layout(wctx);
+#endif
+  if (wctx->zone_col_count)
+    write_zones(wctx->buf, page_size, wctx->page_resv_bytes,
+                wctx->zone_cols, wctx->zone_col_count);
+#if DBLOG_CFG_MULTI_TABLE
+  mark_table(wctx, page_size);
+#endif
+#if DBLOG_CFG_STREAM_BTREE
+  uint32_t leaf_page = wctx->cur_write_page;
+  int8_t vlen;
+  uint32_t last_rowid = read_vint32(wctx->buf
+          + read_uint16(wctx->buf + 5) + LEN_OF_REC_LEN, &vlen);
+#endif
+  int res = seal_page(wctx, page_size);
+  if (res)
+    return res;
+  // zone maps of the next page are formed only when it is sealed
+  uint16_t zone_len = zone_area_len(wctx->zone_col_count);
+  memset(wctx->buf + page_size - zone_len, '\0', zone_len);
+#if DBLOG_CFG_STREAM_BTREE
+  if (is_tree_streamed(wctx))
+    res = add_to_tree(wctx, leaf_page, last_rowid, page_size);
+#endif
+  return res;
+}
+
+// Marks rows appended so far as durable for group commit
+void mark_durable(struct dblog_write_context *wctx) {
+#if DBLOG_CFG_GROUP_COMMIT
+  wctx->durable_rowid = wctx->cur_write_rowid;
+  wctx->commit_bytes = 0;
+  if (wctx->commit_policy && wctx->commit_policy->clock_fn)
+    wctx->commit_tick = wctx->commit_policy->clock_fn(wctx);
+#else
+  (void) wctx;
+#endif
+}
+
+const char sqlite_sig[] = "SQLite format 3";
+const char dblog_sig[]  = "SQLite3 uLogger";
+char default_table_name[] = "t1";
+
+// Adds row of table having given name and script (or a script formed
+// for col_count columns) to schema table in first page, which is in buf
+int add_table_rec(struct dblog_write_context *wctx, char *table_name,
+      char *table_script, int32_t root_page, int32_t page_size) {
+  byte *buf = wctx->buf;
+  int orig_col_count = wctx->col_count;
+  wctx->cur_write_page = 0;
+  wctx->col_count = 5;
+  dblog_append_empty_row(wctx);
   wctx->col_count = orig_col_count;
-  wctx->cur_write_page = 1;
+  dblog_set_col_val(wctx, 0, DBLOG_TYPE_TEXT, "table", 5);
+  if (table_name == NULL)
+    table_name = default_table_name;
+  dblog_set_col_val(wctx, 1, DBLOG_TYPE_TEXT, table_name, strlen(table_name));
+  dblog_set_col_val(wctx, 2, DBLOG_TYPE_TEXT, table_name, strlen(table_name));
+  dblog_set_col_val(wctx, 3, DBLOG_TYPE_INT, &root_page, 4);
+  if (table_script) {
+    uint16_t script_len = strlen(table_script);
+    if (script_len > page_size - 100 - wctx->page_resv_bytes - 8 - 10)
+      return DBLOG_RES_TOO_LONG;
+    dblog_set_col_val(wctx, 4, DBLOG_TYPE_TEXT, table_script, script_len);
+  } else {
+    int table_name_len = strlen(table_name);
+    int script_len = (13 + table_name_len + 2 + 5 * orig_col_count);
+    if (script_len > page_size - 100 - wctx->page_resv_bytes - 8 - 10)
+      return DBLOG_RES_TOO_LONG;
+    dblog_set_col_val(wctx, 4, DBLOG_TYPE_TEXT, buf + 110, script_len);
+    uint16_t last_pos = read_uint16(buf + 105);
+    byte *script_pos;
+    uint16_t rec_len, hdr_len;
+    if (!locate_column(buf + last_pos, 4, &script_pos, &rec_len, &hdr_len,
+            page_size - buf[20] - last_pos))
+      return DBLOG_RES_MALFORMED;
+    memcpy(script_pos, "CREATE TABLE ", 13);
+    script_pos += 13;
+    memcpy(script_pos, table_name, table_name_len);
+    script_pos += table_name_len;
+    *script_pos++ = ' ';
+    *script_pos++ = '(';
+    for (int i = 0; i < orig_col_count; ) {
+      i++;
+      *script_pos++ = 'c';
+      *script_pos++ = '0' + (i < 100 ? 0 : (i / 100));
+      *script_pos++ = '0' + (i < 10 ? 0 : ((i < 100 ? i : i - 100) / 10));
+      *script_pos++ = '0' + (i % 10);
+      *script_pos++ = (i == orig_col_count ? ')' : ',');
+    }
+  }
+  return DBLOG_RES_OK;
+}
+
+// Makes buf ready for appending rows to a table from given page
+void start_leaf_pages(struct dblog_write_context *wctx, uint32_t page_no) {
+  wctx->cur_write_page = page_no;
   wctx->cur_write_rowid = 0;
+  wctx->flushed_rec_count = 0;
+#if DBLOG_CFG_PAGE_LAYOUT
+  wctx->layout_rows = 0;
+#endif
+  mark_durable(wctx);
+#if DBLOG_CFG_FLUSH_SLOTS
+  wctx->flush_seq = 0;
+  wctx->flush_slot = DBLOG_SLOT_NONE;
+#endif
   init_bt_tbl_leaf(wctx->buf);
   wctx->state = DBLOG_ST_WRITE_PENDING;
+#if DBLOG_CFG_WRITE_BEHIND
+  wb_start(wctx);
+#endif
+}
+
+// Writes data into buffer to form first page of Sqlite db
+int form_page1(struct dblog_write_context *wctx, char *table_name, char *table_script) {
+
+  if (wctx->page_size_exp < 9 || wctx->page_size_exp > 16)
+    return DBLOG_RES_INV_PAGE_SZ;
+  uint16_t zone_len = zone_area_len(wctx->zone_col_count);
+#if DBLOG_CFG_FLUSH_SLOTS
+  if (zone_len) // slot mark is at the beginning of reserved bytes
+    zone_len += SLOT_MARK_LEN;
+#endif
+  if (zone_len > wctx->page_resv_bytes)
+    return DBLOG_RES_TOO_LONG;
+  byte *buf = (byte *) wctx->buf;
+  int32_t page_size = get_pagesize(wctx->page_size_exp);
+  wctx->cur_write_rowid = 0;
+  // nothing to flush till first page is written
+  wctx->state = DBLOG_ST_WRITE_NOT_PENDING;
+  mark_durable(wctx);
+  wctx->schema_hdr = NULL;
+#if DBLOG_CFG_STREAM_BTREE
+  wctx->tree_depth = 0;
+#endif
+
+  // 100 byte header - refer https://www.sqlite.org/fileformat.html
+  memcpy(buf, dblog_sig, 16);
+  //memcpy(buf, "SQLite format 3\0", 16);
+  write_uint16(buf + 16, page_size == 65536 ? 1 : (uint16_t) page_size);
+  buf[18] = 1;
+  buf[19] = 1;
+  buf[20] = wctx->page_resv_bytes;
+  buf[21] = 64;
+  buf[22] = 32;
+  buf[23] = 32;
+  //write_uint32(buf + 24, 0);
+  //write_uint32(buf + 28, 0);
+  //write_uint32(buf + 32, 0);
+  //write_uint32(buf + 36, 0);
+  //write_uint32(buf + 40, 0);
+  memset(buf + 24, '\0', 20); // Set to zero, above 5
+  write_uint32(buf + 28, 2); // TODO: Update during finalize
+  write_uint32(buf + 44, 4);
+  //write_uint16(buf + 48, 0);
+  //write_uint16(buf + 52, 0);
+  memset(buf + 48, '\0', 8); // Set to zero, above 2
+  write_uint32(buf + 56, 1);
+  // User version initially 0, set to table leaf count
+  // used to locate last leaf page for binary search
+  // and move to last page.
+  write_uint32(buf + 60, 0);
+  write_uint32(buf + 64, 0);
+  // App ID - set to 0xA5xxxxxx where A5 is signature
+  // next byte is checksum, then no. of zone map columns and
+  // last 5 bits = wctx->max_pages_exp
+  write_uint32(buf + 68, 0xA5000000 | ((uint32_t) wctx->zone_col_count << 8)
+                           | (wctx->max_pages_exp & 0x1F));
+  // reserved space, of which first leaf page (72) and its first rowid (76)
+  // are set during finalize, as leaf pages roll when max_pages_exp is set
+  memset(buf + 72, '\0', 20);
+  write_uint32(buf + 92, 105);
+  write_uint32(buf + 96, 3016000);
+  memset(buf + 100, '\0', page_size - 100); // Set remaing page to zero
+
+  // master table b-tree
+  init_bt_tbl_leaf(buf + 100);
+
+  int res = add_table_rec(wctx, table_name, table_script, 2, page_size);
+  if (res)
+    return res;
+  res = write_page(wctx, 0, page_size);
+  if (res)
+    return res;
+#if DBLOG_CFG_MULTI_TABLE
+  wctx->main_wctx = NULL;
+  wctx->next_table = NULL;
+  wctx->table_idx = 0;
+  wctx->table_count = 1;
+#endif
+  start_leaf_pages(wctx, 1);
 
   return DBLOG_RES_OK;
 
@@ -571,20 +1650,21 @@ int form_page1(struct dblog_write_context *wctx, char *table_name, char *table_s
 // Reads the buffer part by part to avoid reading entire buffer into memory
 // to support low memory systems (2kb ram)
 // The underlying callback function hopefully optimizes repeated IO
+// If leaf_only is 1, returns DBLOG_RES_NOT_FOUND for interior pages
 int get_last_rowid(struct dblog_write_context *wctx, uint32_t pos,
-           int32_t page_size, uint32_t *out_rowid) {
+           int32_t page_size, uint32_t *out_rowid, byte leaf_only) {
   byte src_buf[12];
   int res = read_bytes_wctx(wctx, src_buf, pos * page_size, 12);
   if (res)
     return res;
+  if (leaf_only && *src_buf != 13)
+    return DBLOG_RES_NOT_FOUND;
   uint16_t last_pos = read_uint16(src_buf + 5);
-  if (!last_pos && *src_buf == 5) {
-    *out_rowid = 0;
-    return DBLOG_RES_OK;
-  }
-  if (last_pos > page_size - 12)
-    return DBLOG_RES_MALFORMED;
   uint8_t page_type = *src_buf;
+  // For interior pages, last rowid is after the cell pointers
+  // and last_pos is 0 or close to page end when there are 0 or 1 cells
+  if (page_type == 13 && last_pos > page_size - 12)
+    return DBLOG_RES_MALFORMED;
   uint16_t remaining = page_size - wctx->page_resv_bytes - last_pos;
   uint8_t chk_sum = 0;
   for (int i = 0; i < 8; i++)
@@ -605,6 +1685,21 @@ int get_last_rowid(struct dblog_write_context *wctx, uint32_t pos,
   return DBLOG_RES_OK;
 }
 
+// Reads the table of which given page is a leaf page (see mark_table())
+// and its no. of records. Returns DBLOG_RES_NOT_FOUND if not a leaf page
+int read_page_table(struct dblog_write_context *wctx, uint32_t page_no,
+      int32_t page_size, byte *out_table, uint16_t *out_rec_count) {
+  byte head_buf[5];
+  int res = read_bytes_wctx(wctx, head_buf, page_no * page_size, 5);
+  if (res)
+    return res;
+  if (head_buf[0] != 13)
+    return DBLOG_RES_NOT_FOUND;
+  *out_rec_count = read_uint16(head_buf + 3);
+  return read_bytes_wctx(wctx, out_table, page_no * page_size
+           + table_mark_pos(page_size, wctx->zone_col_count), 1);
+}
+
 // Returns pointer to data of given column index
 // Also returns type of column according to record format
 // See https://www.sqlite.org/fileformat.html#record_format
@@ -631,11 +1726,13 @@ int check_signature(byte *buf) {
   return DBLOG_RES_OK;
 }
 
-byte *locate_col_root_page(byte *buf, int32_t page_size) {
+// Locates root page in the row of given table in schema table
+// Rows of tables come first, as index may follow
+byte *locate_col_root_page(byte *buf, int32_t page_size, byte table_idx) {
   byte *data_ptr;
   uint16_t rec_len;
   uint16_t hdr_len;
-  uint16_t last_pos = read_uint16(buf + 105);
+  uint16_t last_pos = read_uint16(buf + 108 + table_idx * 2);
   if (!locate_column(buf + last_pos, 3,
          &data_ptr, &rec_len, &hdr_len, page_size - last_pos))
     return NULL;
@@ -663,13 +1760,94 @@ int dblog_write_init(struct dblog_write_context *wctx) {
   return dblog_write_init_with_script(wctx, 0, 0);
 }
 
+#if DBLOG_CFG_MULTI_TABLE
+// Makes given context use the file and callbacks of the first table
+void share_file(struct dblog_write_context *wctx,
+      struct dblog_write_context *main_wctx) {
+  wctx->page_size_exp = main_wctx->page_size_exp;
+  wctx->page_resv_bytes = main_wctx->page_resv_bytes;
+  wctx->max_pages_exp = 0;
+  wctx->read_fn = main_wctx->read_fn;
+  wctx->write_fn = main_wctx->write_fn;
+  wctx->flush_fn = main_wctx->flush_fn;
+  wctx->writev_fn = main_wctx->writev_fn;
+  wctx->schema_hdr = NULL;
+}
+
+// Links given context to those of other tables after the first table
+// and turns off features not used when there is more than one table
+void join_table(struct dblog_write_context *wctx,
+      struct dblog_write_context *main_wctx, byte table_idx) {
+  wctx->main_wctx = main_wctx;
+  wctx->next_table = NULL;
+  wctx->table_idx = table_idx;
+  wctx->table_count = 0;
+#if DBLOG_CFG_PAGE_LAYOUT
+  main_wctx->layout_rows = 0;
+#endif
+#if DBLOG_CFG_STREAM_BTREE
+  wctx->tree_depth = DBLOG_TREE_OFF;
+  main_wctx->tree_depth = DBLOG_TREE_OFF;
+#endif
+  struct dblog_write_context **last = &main_wctx->next_table;
+  while (*last)
+    last = &(*last)->next_table;
+  *last = wctx;
+}
+
+// See .h file for API description
+int dblog_add_table(struct dblog_write_context *wctx,
+      struct dblog_write_context *main_wctx, char *table_name, char *table_script) {
+  if (main_wctx->main_wctx || main_wctx->table_count == 0 || main_wctx->table_count == 8
+        || main_wctx->cur_write_rowid || main_wctx->max_pages_exp
+        || wctx->zone_col_count != main_wctx->zone_col_count)
+    return DBLOG_RES_ERR;
+  if (zone_area_len(wctx->zone_col_count) + 1 > main_wctx->page_resv_bytes)
+    return DBLOG_RES_TOO_LONG;
+  int32_t page_size = get_pagesize(main_wctx->page_size_exp);
+  byte table_idx = main_wctx->table_count;
+  share_file(wctx, main_wctx);
+  int res = read_bytes_wctx(wctx, wctx->buf, 0, page_size);
+  if (res)
+    return res;
+  byte *buf = wctx->buf;
+  if (read_uint16(buf + 103) != table_idx)
+    return DBLOG_RES_MALFORMED;
+  uint16_t name_len = strlen(table_name ? table_name : default_table_name);
+  uint16_t rec_len = LEN_OF_REC_LEN + 1 + LEN_OF_HDR_LEN + 15 + 5 + name_len * 2 + 4
+          + (table_script ? (uint16_t) strlen(table_script)
+                          : (uint16_t) (13 + name_len + 2 + 5 * wctx->col_count));
+  if (read_uint16(buf + 105) < 108 + (table_idx + 1) * 2 + CHKSUM_LEN + 4 + rec_len)
+    return DBLOG_RES_TOO_LONG;
+  uint32_t first_page = (table_idx > 1 ? main_wctx->last_page : main_wctx->cur_write_page) + 1;
+  wctx->cur_write_rowid = table_idx;
+  wctx->state = DBLOG_ST_WRITE_NOT_PENDING;
+  res = add_table_rec(wctx, table_name, table_script, first_page + 1, page_size);
+  if (res)
+    return res;
+  // no. of tables - 1 in the 3 bits above max_pages_exp
+  buf[71] = (buf[71] & 0x1F) | (table_idx << 5);
+  res = write_page(wctx, 0, page_size);
+  if (res)
+    return res;
+  join_table(wctx, main_wctx, table_idx);
+  main_wctx->table_count++;
+  main_wctx->last_page = first_page;
+  memset(wctx->buf, '\0', page_size);
+  start_leaf_pages(wctx, first_page);
+  return DBLOG_RES_OK;
+}
+#endif
+
 // Checks space for appending new row
 // If space not available, writes current buffer to disk and
 // initializes buffer as new page
+// Returns 0 if not possible, with the reason in out_res
 uint16_t make_space_for_new_row(struct dblog_write_context *wctx, int32_t page_size,
-           uint16_t len_of_rec_len_rowid, uint16_t new_rec_len) {
+           uint16_t len_of_rec_len_rowid, uint16_t new_rec_len, int *out_res) {
   byte *ptr = wctx->buf + (wctx->buf[0] == 13 ? 0 : 100);
   uint16_t last_pos = read_uint16(ptr + 5);
+  *out_res = DBLOG_RES_MALFORMED;
   if (last_pos && last_pos > page_size - wctx->page_resv_bytes - 7)
     return 0; // corruption
   int rec_count = read_uint16(ptr + 3) + 1;
@@ -679,10 +1857,9 @@ uint16_t make_space_for_new_row(struct dblog_write_context *wctx, int32_t page_s
     last_pos = page_size - wctx->page_resv_bytes;
   if (last_pos && last_pos < ((ptr - wctx->buf) + 9 + CHKSUM_LEN
        + (rec_count * 2) + new_rec_len + len_of_rec_len_rowid)) {
-    int res = write_page(wctx, wctx->cur_write_page, page_size);
-    if (res)
-      return res;
-    wctx->cur_write_page++;
+    *out_res = seal_leaf_page(wctx, page_size);
+    if (*out_res)
+      return 0; // such as write error
     init_bt_tbl_leaf(wctx->buf);
     last_pos = page_size - wctx->page_resv_bytes - new_rec_len - len_of_rec_len_rowid;
   } else {
@@ -727,54 +1904,187 @@ uint16_t write_data(byte *data_ptr, int type, const void *val, uint16_t len) {
   return len;
 }
 
-// See .h file for API description
-int dblog_append_row_with_values(struct dblog_write_context *wctx,
-      uint8_t types[], const void *values[], uint16_t lengths[]) {
+// Returns value of given column of given row
+// from row-major or column-major arrays
+const void *row_col_val(const void *values[], uint16_t lengths[], int col_count,
+      int row, int col_idx, byte col_major, uint16_t *out_len) {
+  if (col_major) {
+    *out_len = lengths[col_idx];
+    if (values[col_idx] == NULL)
+      return NULL;
+    return (const byte *) values[col_idx] + row * lengths[col_idx];
+  }
+  *out_len = lengths[row * col_count + col_idx];
+  return values[row * col_count + col_idx];
+}
 
-  wctx->cur_write_rowid++;
-  byte *ptr = wctx->buf + (wctx->buf[0] == 13 ? 0 : 100);
-  int32_t page_size = get_pagesize(wctx->page_size_exp);
-  uint16_t len_of_rec_len_rowid = LEN_OF_REC_LEN + get_vlen_of_uint32(wctx->cur_write_rowid);
-  uint16_t new_rec_len = 0;
-  uint16_t hdr_len = LEN_OF_HDR_LEN;
+// See .h file for API description
+int dblog_prepare_schema(struct dblog_write_context *wctx, uint8_t types[],
+      uint16_t lengths[], byte *hdr_buf) {
+  uint16_t data_len = 0;
+  byte *hdr_ptr = hdr_buf;
   for (int i = 0; i < wctx->col_count; i++) {
-    if (values[i] != NULL)
-      new_rec_len += (types[i] == DBLOG_TYPE_REAL ? 8 : lengths[i]);
-    uint32_t col_type = derive_col_type_or_len(types[i], values[i], lengths[i]);
-    hdr_len += get_vlen_of_uint32(col_type);
+    // hdr_buf is passed only as a non-NULL value
+    hdr_ptr += write_vint32(hdr_ptr, derive_col_type_or_len(types[i], hdr_buf, lengths[i]));
+    data_len += (types[i] == DBLOG_TYPE_REAL ? 8 : lengths[i]);
   }
-  new_rec_len += hdr_len;
-  uint16_t last_pos = make_space_for_new_row(wctx, page_size,
-                        len_of_rec_len_rowid, new_rec_len);
-  if (!last_pos)
-    return DBLOG_RES_MALFORMED;
-  int rec_count = read_uint16(ptr + 3) + 1;
-  if (rec_count * 2 + 8 >= last_pos)
-    return DBLOG_RES_MALFORMED;
+  wctx->schema_hdr_len = LEN_OF_HDR_LEN + (hdr_ptr - hdr_buf);
+  wctx->schema_rec_len = wctx->schema_hdr_len + data_len;
+  wctx->schema_types = types;
+  wctx->schema_lengths = lengths;
+  wctx->schema_hdr = hdr_buf;
+  return DBLOG_RES_OK;
+}
 
-  write_rec_len_rowid_hdr_len(wctx->buf + last_pos, new_rec_len, 
-                    wctx->cur_write_rowid, hdr_len);
-  byte *rec_ptr = wctx->buf + last_pos + len_of_rec_len_rowid + LEN_OF_HDR_LEN;
+// Returns 1 if the given row has the layout given to dblog_prepare_schema()
+// so that the prepared header can be used as is
+byte matches_schema(struct dblog_write_context *wctx, uint8_t types[],
+      const void *values[], uint16_t lengths[]) {
+  if (wctx->schema_hdr == NULL)
+    return 0;
+  if (types != wctx->schema_types
+        && memcmp(types, wctx->schema_types, wctx->col_count))
+    return 0;
+  if (lengths != wctx->schema_lengths
+        && memcmp(lengths, wctx->schema_lengths, wctx->col_count * sizeof(uint16_t)))
+    return 0;
   for (int i = 0; i < wctx->col_count; i++) {
-    uint32_t col_type = derive_col_type_or_len(types[i], values[i], lengths[i]);
-    int8_t vint_len = write_vint32(rec_ptr, col_type);
-    rec_ptr += vint_len;
+    if (values[i] == NULL)
+      return 0;
   }
-  for (int i = 0; i < wctx->col_count; i++) {
-    if (values[i] != NULL)
-      rec_ptr += write_data(rec_ptr, types[i], values[i], lengths[i]);
+  return 1;
+}
+
+// Appends given rows, packing as many as fit into the current page
+// Page header is updated once per page instead of once per row
+// If col_major is 0, values[] and lengths[] have col_count entries per row
+// Otherwise values[] has one array per column with lengths[] as stride
+int append_rows(struct dblog_write_context *wctx, uint8_t types[],
+      const void *values[], uint16_t lengths[], int row_count, byte col_major) {
+
+  byte *ptr = wctx->buf + (wctx->buf[0] == 13 ? 0 : 100);
+  int32_t page_size = get_pagesize(wctx->page_size_exp);
+  int32_t page_end = page_size - wctx->page_resv_bytes;
+  int32_t last_pos = read_uint16(ptr + 5);
+  int rec_count = read_uint16(ptr + 3);
+  if (last_pos && last_pos > page_end - 7)
+    return DBLOG_RES_MALFORMED; // corruption
+  if (last_pos && (rec_count + 1) * 2 + 8 >= last_pos)
+    return DBLOG_RES_MALFORMED; // corruption
+  if (last_pos == 0)
+    last_pos = page_end;
+  uint32_t col_types[wctx->col_count];
+  byte use_schema = (col_major ? matches_schema(wctx, types, values, lengths) : 0);
+  int res = DBLOG_RES_OK;
+  for (int row = 0; row < row_count; row++) {
+    uint16_t new_rec_len = 0;
+    uint16_t hdr_len = LEN_OF_HDR_LEN;
+    if (!col_major)
+      use_schema = matches_schema(wctx, types, values + row * wctx->col_count,
+                                  lengths + row * wctx->col_count);
+    if (use_schema) {
+      new_rec_len = wctx->schema_rec_len;
+      hdr_len = wctx->schema_hdr_len;
+    } else {
+      for (int i = 0; i < wctx->col_count; i++) {
+        uint16_t len;
+        const void *val = row_col_val(values, lengths, wctx->col_count, row, i, col_major, &len);
+        if (val != NULL)
+          new_rec_len += (types[i] == DBLOG_TYPE_REAL ? 8 : len);
+        col_types[i] = derive_col_type_or_len(types[i], val, len);
+        hdr_len += get_vlen_of_uint32(col_types[i]);
+      }
+      new_rec_len += hdr_len;
+    }
+    uint32_t rowid = wctx->cur_write_rowid + 1;
+    uint16_t len_of_rec_len_rowid = LEN_OF_REC_LEN + get_vlen_of_uint32(rowid);
+    int32_t space_needed = (ptr - wctx->buf) + 9 + CHKSUM_LEN
+                            + new_rec_len + len_of_rec_len_rowid;
+    if (last_pos < space_needed + (rec_count + 1) * 2) {
+      if (rec_count == 0) {
+        res = DBLOG_RES_TOO_LONG;
+        break;
+      }
+      write_uint16(ptr + 3, rec_count);
+      write_uint16(ptr + 5, last_pos);
+      res = seal_leaf_page(wctx, page_size);
+      if (res)
+        return res;
+      init_bt_tbl_leaf(wctx->buf);
+      ptr = wctx->buf; // buf changes when page is sealed
+      rec_count = 0;
+      last_pos = page_end;
+      if (last_pos < 9 + CHKSUM_LEN + new_rec_len + len_of_rec_len_rowid + 2) {
+        res = DBLOG_RES_TOO_LONG;
+        break;
+      }
+    }
+    last_pos -= (new_rec_len + len_of_rec_len_rowid);
+    rec_count++;
+    wctx->cur_write_rowid = rowid;
+#if DBLOG_CFG_GROUP_COMMIT
+    wctx->commit_bytes += new_rec_len + len_of_rec_len_rowid;
+#endif
+    write_rec_len_rowid_hdr_len(wctx->buf + last_pos, new_rec_len, rowid, hdr_len);
+    byte *rec_ptr = wctx->buf + last_pos + len_of_rec_len_rowid + LEN_OF_HDR_LEN;
+    if (use_schema) {
+      memcpy(rec_ptr, wctx->schema_hdr, hdr_len - LEN_OF_HDR_LEN);
+      rec_ptr += hdr_len - LEN_OF_HDR_LEN;
+    } else {
+      for (int i = 0; i < wctx->col_count; i++)
+        rec_ptr += write_vint32(rec_ptr, col_types[i]);
+    }
+    for (int i = 0; i < wctx->col_count; i++) {
+      uint16_t len;
+      const void *val = row_col_val(values, lengths, wctx->col_count, row, i, col_major, &len);
+      if (val != NULL)
+        rec_ptr += write_data(rec_ptr, types[i], val, len);
+    }
+    write_uint16(ptr + 8 - 2 + (rec_count * 2), last_pos);
   }
-  write_uint16(ptr + 3, rec_count);
-  write_uint16(ptr + 5, last_pos);
-  write_uint16(ptr + 8 - 2 + (rec_count * 2), last_pos);
-  wctx->state = DBLOG_ST_WRITE_PENDING;
+  if (rec_count) {
+    write_uint16(ptr + 3, rec_count);
+    write_uint16(ptr + 5, last_pos);
+    wctx->state = DBLOG_ST_WRITE_PENDING;
+  }
+  if (res)
+    return res;
 
+#if DBLOG_CFG_GROUP_COMMIT
+  return dblog_group_commit(wctx);
+#else
   return DBLOG_RES_OK;
+#endif
+}
+
+// See .h file for API description
+int dblog_append_row_with_values(struct dblog_write_context *wctx,
+      uint8_t types[], const void *values[], uint16_t lengths[]) {
+  return append_rows(wctx, types, values, lengths, 1, 0);
+}
+
+// See .h file for API description
+int dblog_append_rows(struct dblog_write_context *wctx, uint8_t types[],
+      const void *values[], uint16_t lengths[], int row_count) {
+  return append_rows(wctx, types, values, lengths, row_count, 0);
+}
+
+// See .h file for API description
+int dblog_append_cols(struct dblog_write_context *wctx, uint8_t types[],
+      const void *col_values[], uint16_t lengths[], int row_count) {
+  return append_rows(wctx, types, col_values, lengths, row_count, 1);
 }
 
 // See .h file for API description
 int dblog_append_empty_row(struct dblog_write_context *wctx) {
 
+  int res;
+#if DBLOG_CFG_GROUP_COMMIT
+  // previous row is complete as values are set before appending next
+  res = dblog_group_commit(wctx);
+  if (res)
+    return res;
+#endif
   wctx->cur_write_rowid++;
   byte *ptr = wctx->buf + (wctx->buf[0] == 13 ? 0 : 100);
   int32_t page_size = get_pagesize(wctx->page_size_exp);
@@ -782,9 +2092,10 @@ int dblog_append_empty_row(struct dblog_write_context *wctx) {
   uint16_t new_rec_len = wctx->col_count;
   new_rec_len += LEN_OF_HDR_LEN;
   uint16_t last_pos = make_space_for_new_row(wctx, page_size,
-                        len_of_rec_len_rowid, new_rec_len);
+                        len_of_rec_len_rowid, new_rec_len, &res);
   if (!last_pos)
-    return DBLOG_RES_MALFORMED;
+    return res;
+  ptr = wctx->buf + (wctx->buf[0] == 13 ? 0 : 100); // buf changes when page is sealed
   int rec_count = read_uint16(ptr + 3) + 1;
   if (rec_count * 2 + 8 >= last_pos)
     return DBLOG_RES_MALFORMED;
@@ -796,6 +2107,9 @@ int dblog_append_empty_row(struct dblog_write_context *wctx) {
   write_uint16(ptr + 5, last_pos);
   write_uint16(ptr + 8 - 2 + (rec_count * 2), last_pos);
   wctx->state = DBLOG_ST_WRITE_PENDING;
+#if DBLOG_CFG_GROUP_COMMIT
+  wctx->commit_bytes += new_rec_len + len_of_rec_len_rowid;
+#endif
 
   return DBLOG_RES_OK;
 }
@@ -826,15 +2140,23 @@ int dblog_set_col_val(struct dblog_write_context *wctx,
     uint16_t prev_last_pos = read_uint16(ptr + 8 + (rec_count - 2) * 2);
     write_uint16(ptr + 3, rec_count - 1);
     write_uint16(ptr + 5, prev_last_pos);
-    saveChecksumBytes(ptr, prev_last_pos);
-    int res = write_page(wctx, wctx->cur_write_page, page_size);
+    byte chksum_bytes[3];
+    saveChecksumBytes(ptr, prev_last_pos, chksum_bytes);
+    byte *old_buf = wctx->buf;
+    int res = seal_leaf_page(wctx, page_size);
     if (res)
       return res;
-    restoreChecksumBytes(ptr, prev_last_pos);
-    wctx->cur_write_page++;
-    init_bt_tbl_leaf(wctx->buf);
     int8_t len_of_rowid;
-    read_vint32(wctx->buf + last_pos + 3, &len_of_rowid);
+    read_vint32(old_buf + last_pos + 3, &len_of_rowid);
+    if (old_buf != wctx->buf) { // sealed page is not to be touched further
+      memcpy(wctx->buf + last_pos, old_buf + last_pos,
+             len_of_rowid + rec_len + LEN_OF_REC_LEN);
+      ptr = wctx->buf + (ptr - old_buf);
+      hdr_ptr = wctx->buf + (hdr_ptr - old_buf);
+      data_ptr = wctx->buf + (data_ptr - old_buf);
+    }
+    restoreChecksumBytes(ptr, prev_last_pos, chksum_bytes);
+    init_bt_tbl_leaf(wctx->buf);
     memmove(wctx->buf + page_size - wctx->page_resv_bytes 
             - len_of_rowid - rec_len - LEN_OF_REC_LEN,
             wctx->buf + last_pos, len_of_rowid + rec_len + LEN_OF_REC_LEN);
@@ -873,6 +2195,10 @@ int dblog_set_col_val(struct dblog_write_context *wctx,
   rec_count--;
   write_uint16(ptr + 8 + rec_count * 2, new_last_pos);
   wctx->state = DBLOG_ST_WRITE_PENDING;
+#if DBLOG_CFG_GROUP_COMMIT
+  if (diff > 0)
+    wctx->commit_bytes += diff;
+#endif
 
   return DBLOG_RES_OK;
 }
@@ -890,47 +2216,424 @@ const void *dblog_get_col_val(struct dblog_write_context *wctx,
            out_col_type, page_size - wctx->page_resv_bytes - last_pos);
 }
 
+// Writes given range of current page
+int write_page_range(struct dblog_write_context *wctx, int32_t from,
+      int32_t to, int32_t page_size) {
+  if ((wctx->write_fn)(wctx, wctx->buf + from,
+          wctx->cur_write_page * page_size + from, to - from) != to - from)
+    return DBLOG_RES_WRITE_ERR;
+  return DBLOG_RES_OK;
+}
+
+// Writes current page, or only the parts changed since it was last
+// flushed if that is cheaper. Records are added downwards and only
+// the last record flushed could have been changed since then (by
+// dblog_set_col_val()), so the changed parts are the header, the
+// cell pointers from that of the last record flushed and the records
+// from the checksum bytes before the last record upto the end of
+// the last record flushed
+int flush_page(struct dblog_write_context *wctx, int32_t page_size) {
+#if DBLOG_CFG_MULTI_TABLE
+  if (wctx->buf[0] == 13)
+    mark_table(wctx, page_size);
+#endif
+#if DBLOG_CFG_FLUSH_SLOTS
+  if (uses_flush_slots(wctx) && wctx->buf[0] == 13) {
+    // written in full, alternating with the slot not having last good copy
+    if (wctx->flush_slot == DBLOG_SLOT_HOME) {
+      int res = write_slot(wctx, shadow_page(wctx, wctx->cur_write_page), page_size);
+      if (!res)
+        wctx->flush_slot = DBLOG_SLOT_SHADOW;
+      return res;
+    }
+    int res = write_slot(wctx, wctx->cur_write_page, page_size);
+    if (!res)
+      wctx->flush_slot = DBLOG_SLOT_HOME;
+    return res;
+  }
+#endif
+  uint16_t rec_count = read_uint16(wctx->buf + 3);
+  uint16_t flushed_count = wctx->flushed_rec_count;
+  wctx->flushed_rec_count = 0;
+  int res;
+  if (wctx->buf[0] != 13 || flushed_count == 0 || flushed_count > rec_count) {
+    res = write_page(wctx, wctx->cur_write_page, page_size);
+  } else {
+    int32_t rec_from = read_uint16(wctx->buf + 5) - CHKSUM_LEN;
+    int32_t rec_to = (flushed_count > 1
+                        ? read_uint16(wctx->buf + 8 + (flushed_count - 2) * 2)
+                        : page_size - wctx->page_resv_bytes);
+    int32_t ptr_from = 8 + (flushed_count - 1) * 2;
+    int32_t ptr_to = 8 + rec_count * 2;
+    if (ptr_from < 64) // header and cell pointers written together
+      ptr_from = 8;
+    int32_t dirty_len = ptr_to - ptr_from + rec_to - rec_from + 8;
+    if (dirty_len > (page_size >> 3))
+      res = write_page(wctx, wctx->cur_write_page, page_size);
+    else {
+      check_sums(wctx->buf, page_size, 0);
+      if (ptr_from == 8)
+        res = write_page_range(wctx, 0, ptr_to, page_size);
+      else {
+        res = write_page_range(wctx, 0, 8, page_size);
+        if (!res)
+          res = write_page_range(wctx, ptr_from, ptr_to, page_size);
+      }
+      if (!res)
+        res = write_page_range(wctx, rec_from, rec_to, page_size);
+    }
+  }
+  if (res)
+    return res;
+  wctx->flushed_rec_count = rec_count;
+  return DBLOG_RES_OK;
+}
+
 // See .h file for API description
 int dblog_flush(struct dblog_write_context *wctx) {
   int32_t page_size = get_pagesize(wctx->page_size_exp);
-  int res = write_page(wctx, wctx->cur_write_page, page_size);
+#if DBLOG_CFG_WRITE_BEHIND
+  int wb_res = dblog_write_behind_drain(wctx, 1);
+  if (wb_res)
+    return wb_res;
+#endif
+  int res = flush_page(wctx, page_size);
   if (res)
     return res;
   int ret = wctx->flush_fn(wctx);
-  if (!ret)
+  if (!ret) {
     wctx->state = DBLOG_ST_WRITE_NOT_PENDING;
+    mark_durable(wctx);
+  }
   return ret;
 }
 
+#if DBLOG_CFG_GROUP_COMMIT
 // See .h file for API description
-int dblog_partial_finalize(struct dblog_write_context *wctx) {
+int dblog_group_commit(struct dblog_write_context *wctx) {
+  struct dblog_commit_policy *policy = wctx->commit_policy;
+  if (policy == NULL || wctx->state != DBLOG_ST_WRITE_PENDING)
+    return DBLOG_RES_OK;
+  uint32_t rows = wctx->cur_write_rowid - wctx->durable_rowid;
+  if ((policy->max_rows && rows >= policy->max_rows)
+      || (policy->max_bytes && wctx->commit_bytes >= policy->max_bytes)
+      || (policy->max_ticks && policy->clock_fn
+           && policy->clock_fn(wctx) - wctx->commit_tick >= policy->max_ticks))
+    return dblog_flush(wctx);
+  return DBLOG_RES_OK;
+}
+#endif
+
+// Returns the Row ID of the first record in the given leaf page
+int get_first_rowid(struct dblog_write_context *wctx, uint32_t pos,
+           int32_t page_size, uint32_t *out_rowid) {
+  byte src_buf[10];
+  int res = read_bytes_wctx(wctx, src_buf, pos * page_size, 10);
+  if (res)
+    return res;
+  if (*src_buf != 13 || read_uint16(src_buf + 3) == 0)
+    return DBLOG_RES_NOT_FOUND;
+  res = read_bytes_wctx(wctx, src_buf, pos * page_size + read_uint16(src_buf + 8), 8);
+  if (res)
+    return res;
+  int8_t vint_len;
+  *out_rowid = read_vint32(src_buf + LEN_OF_REC_LEN, &vint_len);
+  return DBLOG_RES_OK;
+}
+
+// Scans pages from the first for the last leaf page written, before
+// a page that is neither a leaf nor an interior page, or end of file
+void find_last_leaf(struct dblog_write_context *wctx, int32_t page_size) {
+  byte head_buf[8];
+  uint32_t page_no = 0;
+  // current pages of other tables may not have been written
+  byte gap = 0;
+  do {
+    if (read_bytes_wctx(wctx, head_buf, (page_no + 1) * page_size, 8))
+      break;
+    page_no++;
+    if (head_buf[0] == 13)
+      wctx->cur_write_page = page_no;
+    gap = (head_buf[0] == 13 || head_buf[0] == 5 ? 0 : gap + 1);
+#if DBLOG_CFG_MULTI_TABLE
+  } while (gap < wctx->table_count);
+#else
+  } while (gap == 0);
+#endif
+}
+
+#if DBLOG_CFG_PARALLEL_FINALIZE
+
+// Returns 1 if leaf pages are to be read using finalize threads
+byte uses_par_finalize(struct dblog_write_context *wctx) {
+  return wctx->finalize_threads > 1 && wctx->leaf_rowids && wctx->leaf_rowid_count;
+}
+
+// Slice of pages read by a finalize thread
+struct par_slice {
+  struct dblog_write_context *wctx;
+  uint32_t first_pos;   // Position of first page of slice
+  uint32_t count;       // No. of pages in slice
+  uint32_t first_leaf_page; // Leaf positions start from this page
+  uint32_t leaf_count;  //   and roll over after leaf_count pages
+  struct dblog_leaf_rowid *out; // Last rowids read
+  uint32_t last_leaf;   // Last leaf page found by scan, 0 if none
+  byte ended;           // 1 if scan reached a page that is not written
+};
+
+// Reads last rowids of leaf pages of a slice, stopping at
+// an error that stops forming interior pages (see form_tree())
+void *par_read_rowids(void *arg) {
+  struct par_slice *slice = (struct par_slice *) arg;
+  int32_t page_size = get_pagesize(slice->wctx->page_size_exp);
+  for (uint32_t i = 0; i < slice->count; i++) {
+    uint32_t pos = slice->first_pos + i;
+    uint32_t page_no = (pos + slice->first_leaf_page - 2) % slice->leaf_count + 1;
+    struct dblog_leaf_rowid *lr = slice->out + i;
+    lr->res = get_last_rowid(slice->wctx, page_no, page_size, &lr->rowid, 1);
+    if (lr->res && lr->res != DBLOG_RES_INV_CHKSUM && lr->res != DBLOG_RES_NOT_FOUND)
+      break;
+  }
+  return NULL;
+}
+
+// Scans pages of a slice as in find_last_leaf()
+void *par_scan_leaves(void *arg) {
+  struct par_slice *slice = (struct par_slice *) arg;
+  int32_t page_size = get_pagesize(slice->wctx->page_size_exp);
+  byte head_buf[8];
+  slice->last_leaf = 0;
+  slice->ended = 0;
+  for (uint32_t page_no = slice->first_pos; page_no < slice->first_pos + slice->count; page_no++) {
+    if (read_bytes_wctx(slice->wctx, head_buf, page_no * page_size, 8)
+          || (head_buf[0] != 13 && head_buf[0] != 5)) {
+      slice->ended = 1;
+      break;
+    }
+    if (head_buf[0] == 13)
+      slice->last_leaf = page_no;
+  }
+  return NULL;
+}
+
+// Divides count pages from first_pos among finalize_threads slices
+// and runs worker on them, the calling thread taking the first slice
+// Slices are run in the calling thread if a thread cannot be created
+void par_run(struct dblog_write_context *wctx, void *(*worker)(void *),
+      struct par_slice *slices, uint32_t first_pos, uint32_t count) {
+  byte thread_count = wctx->finalize_threads;
+  uint32_t slice_len = (count + thread_count - 1) / thread_count;
+  pthread_t threads[thread_count];
+  byte started[thread_count];
+  for (byte i = 0; i < thread_count; i++) {
+    uint32_t from = i * slice_len;
+    slices[i].wctx = wctx;
+    slices[i].first_pos = first_pos + from;
+    slices[i].count = (from >= count ? 0 : (count - from < slice_len ? count - from : slice_len));
+    started[i] = (i && slices[i].count
+                    && pthread_create(&threads[i], NULL, worker, slices + i) == 0);
+  }
+  for (byte i = 0; i < thread_count; i++) {
+    if (!started[i] && slices[i].count)
+      worker(slices + i);
+  }
+  for (byte i = 1; i < thread_count; i++) {
+    if (started[i])
+      pthread_join(threads[i], NULL);
+  }
+}
+
+// Reads last rowids of count leaf pages from given position
+// (starting with 1) into leaf_rowids using finalize threads
+void par_read_leaf_rowids(struct dblog_write_context *wctx, uint32_t first_leaf_page,
+      uint32_t leaf_count, uint32_t first_pos, uint32_t count) {
+  struct par_slice slices[wctx->finalize_threads];
+  uint32_t slice_len = (count + wctx->finalize_threads - 1) / wctx->finalize_threads;
+  for (byte i = 0; i < wctx->finalize_threads; i++) {
+    slices[i].first_leaf_page = first_leaf_page;
+    slices[i].leaf_count = leaf_count;
+    slices[i].out = wctx->leaf_rowids + i * slice_len;
+  }
+  par_run(wctx, par_read_rowids, slices, first_pos, count);
+}
+
+// Finds last leaf page as in find_last_leaf() scanning
+// leaf_rowid_count pages at a time using finalize threads
+void par_find_last_leaf(struct dblog_write_context *wctx) {
+  struct par_slice slices[wctx->finalize_threads];
+  uint32_t first_pos = 1;
+  while (1) {
+    par_run(wctx, par_scan_leaves, slices, first_pos, wctx->leaf_rowid_count);
+    for (byte i = 0; i < wctx->finalize_threads; i++) {
+      if (slices[i].count == 0)
+        break;
+      if (slices[i].last_leaf)
+        wctx->cur_write_page = slices[i].last_leaf;
+      if (slices[i].ended)
+        return;
+    }
+    first_pos += wctx->leaf_rowid_count;
+  }
+}
+
+#endif
+
+// Finds last leaf page written when leaf pages have rolled over
+// Last rowids increase from the page after the last page written
+// till max pages and then from page 1 to the last page written,
+// so the first page having last rowid less than that of page 1
+// is found using binary search
+int find_last_rolled_leaf(struct dblog_write_context *wctx, int32_t page_size) {
+  uint32_t max_pages = get_max_pages(wctx->max_pages_exp);
+  uint32_t first_rowid, rowid;
+  int res = get_last_rowid(wctx, max_pages, page_size, &rowid, 1);
+  if (res)
+    return DBLOG_RES_OK; // not rolled over yet
+  res = get_last_rowid(wctx, 1, page_size, &first_rowid, 1);
+  if (res && res != DBLOG_RES_INV_CHKSUM)
+    return res;
+  uint32_t first = 2;
+  uint32_t size = max_pages + 1;
+  while (first < size) {
+    uint32_t middle = (first + size) >> 1;
+    res = get_last_rowid(wctx, middle, page_size, &rowid, 1);
+    if (res && res != DBLOG_RES_INV_CHKSUM) // last page could be partly written
+      return res;
+    if (rowid < first_rowid)
+      size = middle;
+    else
+      first = middle + 1;
+  }
+  wctx->cur_write_page = first - 1;
+  return DBLOG_RES_OK;
+}
+
+// Writes pages waiting in write-behind queue and current page, if pending
+int flush_pending(struct dblog_write_context *wctx) {
   int res;
+#if DBLOG_CFG_WRITE_BEHIND
+  if (wctx->state != DBLOG_ST_TO_RECOVER) {
+    res = dblog_write_behind_end(wctx);
+    if (res)
+      return res;
+  }
+#endif
   if (wctx->state == DBLOG_ST_WRITE_PENDING) {
     res = dblog_flush(wctx);
     if (res)
       return res;
   }
+  return DBLOG_RES_OK;
+}
+
+// See .h file for API description
+int dblog_partial_finalize(struct dblog_write_context *wctx) {
+  int res;
+#if DBLOG_CFG_MULTI_TABLE
+  if (wctx->main_wctx)
+    return DBLOG_RES_ERR; // only the first table is to be finalized
+  // pages of other tables are written too as they are finalized together
+  for (struct dblog_write_context *table = wctx->next_table; table; table = table->next_table) {
+    res = flush_pending(table);
+    if (res)
+      return res;
+  }
+#endif
+  res = flush_pending(wctx);
+  if (res)
+    return res;
   int32_t page_size = get_pagesize(wctx->page_size_exp);
+#if DBLOG_CFG_FLUSH_SLOTS || DBLOG_CFG_PAGE_LAYOUT
+  byte recovering = (wctx->cur_write_page == 0);
+#endif
+#if DBLOG_CFG_FLUSH_SLOTS
+  if (uses_flush_slots(wctx) && wctx->flush_slot == DBLOG_SLOT_SHADOW) {
+    res = commit_slot(wctx, page_size);
+    if (res)
+      return res;
+  }
+#endif
   res = read_bytes_wctx(wctx, wctx->buf, 0, page_size);
   if (res)
     return res;
   if (memcmp(wctx->buf, sqlite_sig, 16) == 0)
     return DBLOG_RES_OK;
+  wctx->max_pages_exp = wctx->buf[71] & 0x1F;
+#if DBLOG_CFG_MULTI_TABLE
+  wctx->table_count = (wctx->buf[71] >> 5) + 1;
+#else
+  if (wctx->buf[71] >> 5)
+    return DBLOG_RES_ERR; // more than one table
+#endif
   uint32_t last_leaf_page = read_uint32(wctx->buf + 60);
   // Update the last page no. in first page
   if (last_leaf_page == 0) {
+    if (!wctx->cur_write_page && wctx->max_pages_exp) {
+      res = find_last_rolled_leaf(wctx, page_size);
+      if (res)
+        return res;
+    }
     if (!wctx->cur_write_page) {
-      byte head_buf[8];
-      do {
-        res = read_bytes_wctx(wctx, head_buf, (wctx->cur_write_page + 1) * page_size, 8);
-        if (res)
-          break;
-        if (head_buf[0] == 13)
-          wctx->cur_write_page++;
-      } while (head_buf[0] == 13);
+#if DBLOG_CFG_PARALLEL_FINALIZE
+      if (!has_tables(wctx) && uses_par_finalize(wctx))
+        par_find_last_leaf(wctx);
+      else
+#endif
+      find_last_leaf(wctx, page_size);
+#if DBLOG_CFG_MULTI_TABLE
+      wctx->last_page = wctx->cur_write_page;
+#endif
+    }
+#if DBLOG_CFG_FLUSH_SLOTS
+    if (recovering && wctx->cur_write_page && uses_flush_slots(wctx)) {
+      res = recover_slot(wctx, page_size);
+      if (res)
+        return res;
+      res = read_bytes_wctx(wctx, wctx->buf, 0, page_size);
+      if (res)
+        return res;
     }
+#endif
     if (wctx->cur_write_page) {
+#if DBLOG_CFG_STREAM_BTREE
+      if (is_tree_streamed(wctx)) {
+        uint32_t root_page;
+        res = flush_tree(wctx, &root_page, page_size);
+        if (res)
+          return res;
+        byte *data_ptr = locate_col_root_page(wctx->buf, page_size - wctx->page_resv_bytes, 0);
+        if (data_ptr == NULL)
+          return DBLOG_RES_MALFORMED;
+        write_uint32(data_ptr, root_page + 1); // update root_page
+        write_uint32(wctx->buf + 28, root_page + 1); // update page_count
+      }
+#endif
+      if (wctx->max_pages_exp) {
+        // if page after last is a leaf, pages have rolled over
+        uint32_t first_leaf_page = next_leaf_page(wctx->cur_write_page, wctx->max_pages_exp);
+        uint32_t first_rowid;
+        if (get_first_rowid(wctx, first_leaf_page, page_size, &first_rowid)) {
+          first_leaf_page = 1;
+          res = get_first_rowid(wctx, first_leaf_page, page_size, &first_rowid);
+          if (res)
+            return res;
+        }
+        write_uint32(wctx->buf + 72, first_leaf_page);
+        write_uint32(wctx->buf + 76, first_rowid);
+      }
+#if DBLOG_CFG_PAGE_LAYOUT
+      if (!recovering) {
+        write_uint32(wctx->buf + 80, wctx->layout_page);
+        write_uint32(wctx->buf + 84, wctx->layout_rowid);
+        write_uint16(wctx->buf + 88, wctx->layout_rows);
+      }
+#endif
+#if DBLOG_CFG_MULTI_TABLE
+      write_uint32(wctx->buf + 60, wctx->table_count > 1
+                     ? wctx->last_page : wctx->cur_write_page);
+#else
       write_uint32(wctx->buf + 60, wctx->cur_write_page);
+#endif
       res = write_page(wctx, 0, page_size);
       if (res)
         return res;
@@ -940,73 +2643,480 @@ int dblog_partial_finalize(struct dblog_write_context *wctx) {
   return DBLOG_RES_OK;
 }
 
-// See .h file for API description
-int dblog_finalize(struct dblog_write_context *wctx) {
+// Reads last value of given column in given leaf page
+// Returns DBLOG_RES_NOT_FOUND if it is an interior page
+int read_leaf_last_val(struct dblog_write_context *wctx, uint32_t page_no,
+      int col_idx, int32_t page_size, byte *val, uint16_t val_len,
+      uint32_t *out_col_type) {
+  byte head_buf[12];
+  int res = read_bytes_wctx(wctx, head_buf, page_no * page_size, 12);
+  if (res)
+    return res;
+  if (*head_buf == 5)
+    return DBLOG_RES_NOT_FOUND;
+  uint16_t last_pos = read_uint16(head_buf + 5);
+  if (*head_buf != 13 || last_pos > page_size - 12)
+    return DBLOG_RES_MALFORMED;
+  res = read_bytes_wctx(wctx, head_buf, page_no * page_size + last_pos, 12);
+  if (res)
+    return res;
+  int8_t vint_len;
+  read_vint32(head_buf + LEN_OF_REC_LEN, &vint_len);
+  uint16_t rec_len = read_vint16(head_buf, NULL) + vint_len + LEN_OF_REC_LEN;
+  if (last_pos + rec_len > page_size)
+    return DBLOG_RES_MALFORMED;
+  byte rec_buf[rec_len];
+  res = read_bytes_wctx(wctx, rec_buf, page_no * page_size + last_pos, rec_len);
+  if (res)
+    return res;
+  uint16_t hdr_len;
+  byte *data_ptr;
+  byte *hdr_ptr = locate_column(rec_buf, col_idx, &data_ptr, &rec_len, &hdr_len, rec_len);
+  if (!hdr_ptr)
+    return DBLOG_RES_MALFORMED;
+  *out_col_type = read_vint32(hdr_ptr, &vint_len);
+  uint32_t data_len = dblog_derive_data_len(*out_col_type);
+  if (data_len > val_len)
+    return DBLOG_RES_TOO_LONG;
+  memcpy(val, data_ptr, data_len);
+  return DBLOG_RES_OK;
+}
 
-  int res = dblog_partial_finalize(wctx);
+// Reads last value of key_dir_col in n-th leaf page into entry
+// (column type and value) and sets its length in out_len, which is
+// 0 for an interior page formed during append
+int read_key_dir_entry(struct dblog_write_context *wctx, uint32_t n,
+      uint32_t first_leaf_page, uint32_t leaf_count, int32_t page_size,
+      byte *entry, byte *out_len) {
+  uint32_t col_type;
+  *out_len = 0;
+  int res = read_leaf_last_val(wctx, (n + first_leaf_page - 2) % leaf_count + 1,
+              wctx->key_dir_col - 1, page_size, entry + 2, 253, &col_type);
+  if (res == DBLOG_RES_NOT_FOUND && n > 1)
+    return DBLOG_RES_OK;
   if (res)
     return res;
+  uint32_t data_len = dblog_derive_data_len(col_type);
+  write_uint16(entry, col_type);
+  *out_len = 2 + (col_type < 12 && data_len < 8 ? 8 : data_len);
+  return DBLOG_RES_OK;
+}
 
-  if (memcmp(wctx->buf, sqlite_sig, 16) == 0)
+// Writes a page of key directory in buf, which is also a free list
+// trunk page having no leaves, linked to next_trunk, so that Sqlite
+// sees the directory as free pages (see finalize_key_dir())
+int write_key_dir_page(struct dblog_write_context *wctx, uint32_t page_no,
+      uint32_t next_trunk, int32_t page_size) {
+  write_uint32(wctx->buf, next_trunk);
+  write_uint32(wctx->buf + 4, 0);
+  if ((wctx->write_fn)(wctx, wctx->buf, page_no * page_size, page_size) != page_size)
+    return DBLOG_RES_WRITE_ERR;
+  memset(wctx->buf, '\0', page_size);
+  return DBLOG_RES_OK;
+}
+
+// Writes key directory (see key_dir_col) starting at dir_page.
+// First level has the last value of key_dir_col in each leaf page
+// as entries of same length (column type and value) packed into as
+// many pages as needed. Each level above has last entry of each page
+// of the level below, till a level fits in one page. The longest
+// value is found first, so nothing is written and out_entry_len is
+// set to 0 if a value is too long or cannot be read. Pages are linked
+// one to the next and the last to free_trunk (see write_key_dir_page())
+int write_key_dir(struct dblog_write_context *wctx, uint32_t dir_page,
+      uint32_t first_leaf_page, uint32_t leaf_count, int32_t page_size,
+      uint32_t free_trunk, byte *out_entry_len, uint32_t *out_page_count) {
+  *out_entry_len = 0;
+  *out_page_count = 0;
+  byte entry[255];
+  byte entry_len = 0;
+  byte len;
+  for (uint32_t n = 1; n <= leaf_count; n++) {
+    int res = read_key_dir_entry(wctx, n, first_leaf_page, leaf_count,
+                page_size, entry, &len);
+    if (res)
+      return (res == DBLOG_RES_READ_ERR ? res : DBLOG_RES_OK);
+    if (len > entry_len)
+      entry_len = len;
+  }
+  if (!entry_len)
+    return DBLOG_RES_OK;
+  uint16_t per_page = (page_size - KEY_DIR_HDR_LEN) / entry_len;
+  uint32_t page_count = 0;
+  uint32_t level_pages = leaf_count;
+  do {
+    level_pages = (level_pages + per_page - 1) / per_page;
+    page_count += level_pages;
+  } while (level_pages > 1);
+  uint32_t end_page = dir_page + page_count;
+  uint16_t slot = 0;
+  uint32_t page_no = dir_page;
+  memset(wctx->buf, '\0', page_size);
+  for (uint32_t n = 1; n <= leaf_count; n++) {
+    int res = read_key_dir_entry(wctx, n, first_leaf_page, leaf_count,
+                page_size, entry, &len);
+    if (res)
+      return res;
+    if (len > entry_len)
+      return DBLOG_RES_MALFORMED; // changed since read above
+    if (len) // else interior page formed during append, repeat last
+      memset(entry + len, '\0', entry_len - len);
+    memcpy(wctx->buf + KEY_DIR_HDR_LEN + slot * entry_len, entry, entry_len);
+    if (++slot == per_page || n == leaf_count) {
+      res = write_key_dir_page(wctx, page_no, page_no + 1 < end_page
+              ? page_no + 2 : free_trunk, page_size);
+      page_no++;
+      if (res)
+        return res;
+      slot = 0;
+    }
+  }
+  uint32_t level_page = dir_page;
+  uint32_t level_count = leaf_count;
+  while (page_no - level_page > 1) {
+    level_pages = page_no - level_page;
+    for (uint32_t i = 0; i < level_pages; i++) {
+      uint16_t last = (i < level_pages - 1 ? per_page : level_count - i * per_page) - 1;
+      int res = read_bytes_wctx(wctx, wctx->buf + KEY_DIR_HDR_LEN + slot * entry_len,
+                  (level_page + i) * page_size + KEY_DIR_HDR_LEN + last * entry_len,
+                  entry_len);
+      if (res)
+        return res;
+      if (++slot == per_page || i == level_pages - 1) {
+        res = write_key_dir_page(wctx, page_no, page_no + 1 < end_page
+                ? page_no + 2 : free_trunk, page_size);
+        page_no++;
+        if (res)
+          return res;
+        slot = 0;
+      }
+    }
+    level_page += level_pages;
+    level_count = level_pages;
+  }
+  *out_entry_len = entry_len;
+  *out_page_count = page_count;
+  return DBLOG_RES_OK;
+}
+
+// Writes key directory if key_dir_col is given, after last page
+// as given in first page and records it in first page at 90, 91
+// Directory pages are put at the head of the free list, so that
+// its first trunk page is the first page of the directory
+int finalize_key_dir(struct dblog_write_context *wctx,
+      uint32_t first_leaf_page, uint32_t leaf_count, int32_t page_size) {
+  if (!wctx->key_dir_col)
     return DBLOG_RES_OK;
+  byte entry_len;
+  uint32_t dir_page = read_uint32(wctx->buf + 28);
+  uint32_t page_count;
+  int res = write_key_dir(wctx, dir_page, first_leaf_page, leaf_count,
+              page_size, read_uint32(wctx->buf + 32), &entry_len, &page_count);
+  if (res)
+    return res;
+  res = read_bytes_wctx(wctx, wctx->buf, 0, page_size);
+  if (res)
+    return res;
+  wctx->buf[90] = (entry_len ? wctx->key_dir_col : 0);
+  wctx->buf[91] = entry_len;
+  if (page_count) {
+    write_uint32(wctx->buf + 28, dir_page + page_count); // update page_count
+    write_uint32(wctx->buf + 32, dir_page + 1);
+    write_uint32(wctx->buf + 36, read_uint32(wctx->buf + 36) + page_count);
+  }
+  return DBLOG_RES_OK;
+}
 
-  int32_t page_size = get_pagesize(wctx->page_size_exp);
-  uint32_t next_level_cur_pos = wctx->cur_write_page + 1;
+// Writes interior pages collected in write-behind buffers by
+// write_inner_page(), the last of which is before next_page_no
+int write_inner_batch(struct dblog_write_context *wctx,
+      uint32_t next_page_no, int32_t page_size, byte *batch_count) {
+#if DBLOG_CFG_WRITE_BEHIND
+  if (*batch_count == 0)
+    return DBLOG_RES_OK;
+  byte *bufs[wctx->wb_buf_count];
+  for (byte i = 0; i < *batch_count; i++)
+    bufs[i] = wctx->wb_bufs[(wctx->wb_cur + wctx->wb_buf_count
+                               - *batch_count + i) % wctx->wb_buf_count];
+  int res = write_pages(wctx, bufs, *batch_count,
+                next_page_no - *batch_count, page_size);
+  *batch_count = 0;
+  wctx->buf = wctx->wb_bufs[wctx->wb_cur];
+  return res;
+#else
+  (void) wctx;
+  (void) next_page_no;
+  (void) page_size;
+  (void) batch_count;
+  return DBLOG_RES_OK;
+#endif
+}
+
+// Writes interior page formed in buf during finalize
+// If writev_fn is available, the write-behind buffers (idle during
+// finalize) are used to collect pages so they are written together
+// when all buffers are used or when write_inner_batch() is called
+int write_inner_page(struct dblog_write_context *wctx, uint32_t page_no,
+      int32_t page_size, byte *batch_count) {
+#if DBLOG_CFG_WRITE_BEHIND
+  if (wctx->writev_fn && wctx->wb_buf_count > 1) {
+    if (wctx->buf != wctx->wb_bufs[wctx->wb_cur]) { // such as when recovering
+      memcpy(wctx->wb_bufs[wctx->wb_cur], wctx->buf, page_size);
+      wctx->buf = wctx->wb_bufs[wctx->wb_cur];
+    }
+    check_sums(wctx->buf, page_size, 0);
+    wctx->wb_cur = (wctx->wb_cur + 1) % wctx->wb_buf_count;
+    (*batch_count)++;
+    if (*batch_count == wctx->wb_buf_count)
+      return write_inner_batch(wctx, page_no + 1, page_size, batch_count);
+    wctx->buf = wctx->wb_bufs[wctx->wb_cur];
+    return DBLOG_RES_OK;
+  }
+#else
+  (void) batch_count;
+#endif
+  return write_page(wctx, page_no, page_size);
+}
+
+// Forms interior pages over leaf_count leaf pages starting from
+// first_leaf_page (rolling over), writing them from *page_no, which
+// is set to the root page (numbered from 1) after the last is written
+// If own_count is not 0, only leaf pages marked with table_idx, of
+// which there are own_count, are taken (see dblog_add_table())
+int form_tree(struct dblog_write_context *wctx, uint32_t first_leaf_page,
+      uint32_t leaf_count, byte table_idx, uint32_t own_count,
+      uint32_t *page_no, int32_t page_size) {
+  uint32_t next_level_cur_pos = *page_no;
   uint32_t next_level_begin_pos = next_level_cur_pos;
   uint32_t cur_level_pos = 1;
+  uint32_t cur_level_end = leaf_count + 1;
+  uint32_t own_left = own_count;
+  uint32_t child_page = 1;
   uint32_t rowid;
-  while (wctx->cur_write_page != 1) {
+  byte batch_count = 0;
+  int res;
+#if DBLOG_CFG_PARALLEL_FINALIZE
+  // leaf positions whose last rowids are in leaf_rowids
+  uint32_t read_from = 0;
+  uint32_t read_count = 0;
+#endif
+  while (leaf_count != 1) {
     init_bt_tbl_inner(wctx->buf);
-    while (cur_level_pos < next_level_begin_pos) {
-      res = get_last_rowid(wctx, cur_level_pos, page_size, &rowid);
+    while (cur_level_pos < cur_level_end) {
+      child_page = cur_level_pos;
+      byte is_leaf = (cur_level_pos <= leaf_count);
+      if (is_leaf)
+        child_page = (cur_level_pos + first_leaf_page - 2) % leaf_count + 1;
+      if (is_leaf && own_count) {
+        byte page_table;
+        uint16_t rec_count;
+        res = read_page_table(wctx, child_page, page_size, &page_table, &rec_count);
+        if (res && res != DBLOG_RES_NOT_FOUND)
+          return res;
+        if (res || page_table != table_idx || rec_count == 0) {
+          cur_level_pos++;
+          continue;
+        }
+        own_left--;
+      }
+      // interior pages formed during append are skipped at leaf level
+#if DBLOG_CFG_PARALLEL_FINALIZE
+      if (is_leaf && !own_count && uses_par_finalize(wctx)) {
+        if (cur_level_pos >= read_from + read_count) {
+          read_from = cur_level_pos;
+          read_count = leaf_count + 1 - read_from;
+          if (read_count > wctx->leaf_rowid_count)
+            read_count = wctx->leaf_rowid_count;
+          par_read_leaf_rowids(wctx, first_leaf_page, leaf_count, read_from, read_count);
+        }
+        struct dblog_leaf_rowid *lr = wctx->leaf_rowids + cur_level_pos - read_from;
+        res = lr->res;
+        rowid = lr->rowid;
+      } else
+#endif
+      res = get_last_rowid(wctx, child_page, page_size, &rowid, is_leaf);
       if (res) {
         cur_level_pos++;
-        if (res == DBLOG_RES_INV_CHKSUM)
+        if (res == DBLOG_RES_INV_CHKSUM || res == DBLOG_RES_NOT_FOUND)
           continue;
         else
           break;
       }
-      if (add_rec_to_inner_tbl(wctx, wctx->buf, rowid, cur_level_pos)) {
-        res = write_page(wctx, next_level_cur_pos, page_size);
+      if (add_rec_to_inner_tbl(wctx, wctx->buf, rowid, child_page)) {
+        // if only one child is left, last row moves to right most pointer
+        // and this child goes to the next page, so that the last page of
+        // the level has atleast two children and does not end up empty
+        byte carry = ((is_leaf && own_count ? own_left == 1
+                                            : cur_level_pos + 2 == cur_level_end)
+                        && read_uint16(wctx->buf + 3) > 1);
+        if (carry)
+          remove_last_inner_rec(wctx->buf);
+        res = write_inner_page(wctx, next_level_cur_pos, page_size, &batch_count);
         if (res)
           return res;
         next_level_cur_pos++;
         init_bt_tbl_inner(wctx->buf);
+        if (carry)
+          add_rec_to_inner_tbl(wctx, wctx->buf, rowid, child_page);
       }
       cur_level_pos++;
     }
-    uint16_t rec_count = read_uint16(wctx->buf + 3);
-    if (rec_count) { // remove last row and write as right most pointer
-      write_uint32(wctx->buf + 8, cur_level_pos);
-      rec_count--;
-      write_vint32(wctx->buf + 12 + rec_count * 2, rowid);
-      write_uint16(wctx->buf + 3, rec_count);
-      if (rec_count) {
-        write_uint16(wctx->buf + 5,
-          read_uint16(wctx->buf + 12 + (rec_count - 1) * 2));
-      } else
-        write_uint16(wctx->buf + 5, 0);
-      res = write_page(wctx, next_level_cur_pos, page_size);
+    if (read_uint16(wctx->buf + 3)) {
+      remove_last_inner_rec(wctx->buf);
+      res = write_inner_page(wctx, next_level_cur_pos, page_size, &batch_count);
       if (res)
         return res;
       next_level_cur_pos++;
     }
+    // pages of this level are read back to form the next level
+    res = write_inner_batch(wctx, next_level_cur_pos, page_size, &batch_count);
+    if (res)
+      return res;
     if (next_level_begin_pos == next_level_cur_pos - 1)
       break;
     else {
       cur_level_pos = next_level_begin_pos;
+      cur_level_end = next_level_cur_pos;
       next_level_begin_pos = next_level_cur_pos;
     }
   }
+  *page_no = next_level_cur_pos;
+  return DBLOG_RES_OK;
+}
+
+#if DBLOG_CFG_MULTI_TABLE
+// Forms B-Tree of each table when there is more than one table (see
+// dblog_add_table()), one after another after the last leaf page.
+// Leaf pages of each table are counted first, so that the last
+// interior page of the lowest level gets atleast two of them.
+// A table having no rows gets an empty leaf page as root page,
+// in place of the one written when it was flushed, if any
+int finalize_tables(struct dblog_write_context *wctx, int32_t page_size) {
+  uint32_t last_page = read_uint32(wctx->buf + 60);
+  uint32_t leaf_counts[8];
+  uint32_t roots[8];
+  memset(leaf_counts, '\0', sizeof(leaf_counts));
+  memset(roots, '\0', sizeof(roots));
+  for (uint32_t page_no = 1; page_no <= last_page; page_no++) {
+    byte page_table;
+    uint16_t rec_count;
+    int res = read_page_table(wctx, page_no, page_size, &page_table, &rec_count);
+    if (res && res != DBLOG_RES_NOT_FOUND)
+      return res;
+    if (res == DBLOG_RES_OK && page_table < wctx->table_count) {
+      if (rec_count)
+        leaf_counts[page_table]++;
+      if (rec_count || !leaf_counts[page_table])
+        roots[page_table] = page_no + 1; // root if it is the only one
+    }
+  }
+  uint32_t next_page = last_page + 1;
+  for (byte i = 0; i < wctx->table_count; i++) {
+    int res;
+    if (leaf_counts[i] == 0) {
+      memset(wctx->buf, '\0', page_size);
+      init_bt_tbl_leaf(wctx->buf);
+      // content area starts at end as there are no records
+      write_uint16(wctx->buf + 5, page_size - wctx->page_resv_bytes);
+      wctx->buf[table_mark_pos(page_size, wctx->zone_col_count)] = i;
+      if (!roots[i])
+        roots[i] = ++next_page;
+      res = write_page(wctx, roots[i] - 1, page_size);
+    } else if (leaf_counts[i] > 1) {
+      res = form_tree(wctx, 1, last_page, i, leaf_counts[i], &next_page, page_size);
+      roots[i] = next_page;
+    } else
+      res = DBLOG_RES_OK;
+    if (res)
+      return res;
+  }
+  int res = read_bytes_wctx(wctx, wctx->buf, 0, page_size);
+  if (res)
+    return res;
+  for (byte i = 0; i < wctx->table_count; i++) {
+    byte *data_ptr = locate_col_root_page(wctx->buf,
+                       page_size - wctx->page_resv_bytes, i);
+    if (data_ptr == NULL)
+      return DBLOG_RES_MALFORMED;
+    write_uint32(data_ptr, roots[i]);
+  }
+  write_uint32(wctx->buf + 28, next_page); // page_count
+  memcpy(wctx->buf, sqlite_sig, 16);
+  return write_page(wctx, 0, page_size);
+}
+#endif
+
+// See .h file for API description
+int dblog_finalize(struct dblog_write_context *wctx) {
+
+  int res = dblog_partial_finalize(wctx);
+  if (res)
+    return res;
+
+  if (memcmp(wctx->buf, sqlite_sig, 16) == 0)
+    return DBLOG_RES_OK;
+
+  int32_t page_size = get_pagesize(wctx->page_size_exp);
+#if DBLOG_CFG_MULTI_TABLE
+  if (wctx->table_count > 1)
+    return finalize_tables(wctx, page_size);
+#endif
+  // If leaf pages have rolled over, they are taken starting from
+  // first leaf page and interior pages are formed after max pages
+  uint32_t first_leaf_page = read_uint32(wctx->buf + 72);
+  uint32_t leaf_count = wctx->cur_write_page;
+  if (first_leaf_page > 1)
+    leaf_count = get_max_pages(wctx->max_pages_exp);
+  else
+    first_leaf_page = 1;
+#if DBLOG_CFG_STREAM_BTREE
+  if (is_tree_streamed(wctx)) {
+    // interior pages and root page already written by partial finalize
+#if DBLOG_CFG_FLUSH_SLOTS
+    res = free_shadow_page(wctx, page_size);
+    if (res)
+      return res;
+#endif
+    res = finalize_key_dir(wctx, first_leaf_page, leaf_count, page_size);
+    if (res)
+      return res;
+    memcpy(wctx->buf, sqlite_sig, 16);
+    return write_page(wctx, 0, page_size);
+  }
+#endif
+  uint32_t next_level_cur_pos = leaf_count + 1;
+  res = form_tree(wctx, first_leaf_page, leaf_count, 0, 0, &next_level_cur_pos, page_size);
+  if (res)
+    return res;
 
   res = read_bytes_wctx(wctx, wctx->buf, 0, page_size);
   if (res)
     return res;
-  byte *data_ptr = locate_col_root_page(wctx->buf, page_size - wctx->page_resv_bytes);
+  byte *data_ptr = locate_col_root_page(wctx->buf, page_size - wctx->page_resv_bytes, 0);
   if (data_ptr == NULL)
     return DBLOG_RES_MALFORMED;
   write_uint32(data_ptr, next_level_cur_pos); // update root_page
   write_uint32(wctx->buf + 28, next_level_cur_pos); // update page_count
+#if DBLOG_CFG_FLUSH_SLOTS
+  res = free_shadow_page(wctx, page_size);
+  if (res)
+    return res;
+#endif
+#if DBLOG_CFG_STREAM_BTREE
+  if (first_leaf_page == 1 && may_have_stray_pages(wctx)) {
+    res = free_stray_pages(wctx, leaf_count, page_size);
+    if (res)
+      return res;
+  }
+#endif
+  if (wctx->key_dir_col) {
+    res = write_page(wctx, 0, page_size);
+    if (res)
+      return res;
+    res = finalize_key_dir(wctx, first_leaf_page, leaf_count, page_size);
+    if (res)
+      return res;
+  }
   memcpy(wctx->buf, sqlite_sig, 16);
   res = write_page(wctx, 0, page_size);
   if (res)
@@ -1015,21 +3125,727 @@ int dblog_finalize(struct dblog_write_context *wctx) {
   return DBLOG_RES_OK;
 }
 
-// See .h file for API description
-int dblog_not_finalized(struct dblog_write_context *wctx) {
-  int res = read_bytes_wctx(wctx, wctx->buf, 0, 72);
-  if (res)
-    return res;
-  if (memcmp(wctx->buf, sqlite_sig, 16) == 0)
-    return DBLOG_RES_OK;
-  return DBLOG_RES_NOT_FINALIZED;
+// Returns order of storage class of given column type
+// as compared by SQLite: NULL, numbers, text and then blob
+byte val_class(uint32_t col_type) {
+  if (col_type == 0)
+    return 0;
+  if (col_type < 12)
+    return 1;
+  return col_type % 2 ? 2 : 3;
 }
 
-int32_t dblog_read_page_size(struct dblog_write_context *wctx) {
-  int res = read_bytes_wctx(wctx, wctx->buf, 0, 72);
-  if (res)
-    return res;
-  if (check_signature(wctx->buf))
+// Compares two values given as column type and data in the same
+// way as SQLite does with BINARY collation and returns -1, 0 or 1
+int compare_rec_vals(uint32_t type1, const byte *val1, uint32_t type2, const byte *val2) {
+  byte cls1 = val_class(type1);
+  byte cls2 = val_class(type2);
+  if (cls1 != cls2)
+    return cls1 < cls2 ? -1 : 1;
+  if (cls1 == 1) {
+    if (type1 != 7 && type2 != 7) {
+      int64_t ival1 = read_serial_int(val1, type1);
+      int64_t ival2 = read_serial_int(val2, type2);
+      return ival1 < ival2 ? -1 : ival1 > ival2;
+    }
+    if (type1 == 7 && type2 == 7) {
+      // IEEE-754 bits ordered as unsigned integers
+      uint64_t bits1 = read_uint64((byte *) val1);
+      uint64_t bits2 = read_uint64((byte *) val2);
+      bits1 = (bits1 >> 63 ? ~bits1 : bits1 | 0x8000000000000000ULL);
+      bits2 = (bits2 >> 63 ? ~bits2 : bits2 | 0x8000000000000000ULL);
+      return bits1 < bits2 ? -1 : bits1 > bits2;
+    }
+    double dval1, dval2;
+    uint64_t bytes64;
+    if (type1 == 7) {
+      bytes64 = read_uint64((byte *) val1);
+      memcpy(&dval1, &bytes64, 8);
+    } else
+      dval1 = (double) read_serial_int(val1, type1);
+    if (type2 == 7) {
+      bytes64 = read_uint64((byte *) val2);
+      memcpy(&dval2, &bytes64, 8);
+    } else
+      dval2 = (double) read_serial_int(val2, type2);
+    return dval1 < dval2 ? -1 : dval1 > dval2;
+  }
+  if (cls1 > 1) {
+    uint32_t len1 = dblog_derive_data_len(type1);
+    uint32_t len2 = dblog_derive_data_len(type2);
+    int res = memcmp(val1, val2, len1 < len2 ? len1 : len2);
+    if (res)
+      return res < 0 ? -1 : 1;
+    return len1 < len2 ? -1 : len1 > len2;
+  }
+  return 0;
+}
+
+// Forms index entry in the format of leaf cell of index b-tree
+// (payload length and record of value and rowid) and returns its
+// length or 0 if payload would be longer than max_payload
+// See https://www.sqlite.org/fileformat.html#b_tree_pages
+uint16_t form_idx_entry(byte *entry, uint32_t col_type, const byte *val,
+      uint32_t rowid, uint16_t max_payload) {
+  uint32_t val_len = dblog_derive_data_len(col_type);
+  byte rowid_type = (rowid < 0x80 ? 1 : (rowid < 0x8000 ? 2
+                      : (rowid < 0x800000 ? 3 : (rowid < 0x80000000 ? 4 : 5))));
+  byte rowid_len = (rowid_type == 5 ? 6 : rowid_type);
+  byte hdr_len = 2 + get_vlen_of_uint32(col_type);
+  uint32_t payload = hdr_len + val_len + rowid_len;
+  if (payload > max_payload)
+    return 0;
+  byte *ptr = entry + write_vint32(entry, payload);
+  *ptr++ = hdr_len;
+  ptr += write_vint32(ptr, col_type);
+  *ptr++ = rowid_type;
+  memcpy(ptr, val, val_len);
+  ptr += val_len;
+  while (rowid_len--)
+    *ptr++ = ((uint64_t) rowid >> (8 * rowid_len)) & 0xFF;
+  return ptr - entry;
+}
+
+// Locates value and rowid of given index entry
+void parse_idx_entry(const byte *entry, uint32_t *out_col_type,
+      const byte **out_val, uint32_t *out_rowid) {
+  int8_t vint_len;
+  read_vint32((byte *) entry, &vint_len);
+  const byte *hdr_ptr = entry + vint_len;
+  *out_col_type = read_vint32((byte *) hdr_ptr + 1, &vint_len);
+  *out_val = hdr_ptr + *hdr_ptr;
+  *out_rowid = (uint32_t) read_serial_int(*out_val
+                 + dblog_derive_data_len(*out_col_type), hdr_ptr[1 + vint_len]);
+}
+
+// Returns length of given index entry
+uint16_t idx_entry_len(const byte *entry) {
+  int8_t vint_len;
+  uint32_t payload = read_vint32((byte *) entry, &vint_len);
+  return vint_len + payload;
+}
+
+// Compares index entries by value and then by rowid
+int compare_idx_entries(const byte *entry1, const byte *entry2) {
+  uint32_t type1, type2, rowid1, rowid2;
+  const byte *val1, *val2;
+  parse_idx_entry(entry1, &type1, &val1, &rowid1);
+  parse_idx_entry(entry2, &type2, &val2, &rowid2);
+  int res = compare_rec_vals(type1, val1, type2, val2);
+  if (res)
+    return res;
+  return rowid1 < rowid2 ? -1 : rowid1 > rowid2;
+}
+
+// Compares pointers to index entries for qsort()
+int compare_idx_ptrs(const void *ptr1, const void *ptr2) {
+  return compare_idx_entries(*((byte **) ptr1), *((byte **) ptr2));
+}
+
+// Sequence of index entries written to or read from scratch pages
+// by dblog_finalize_with_index(), a page at a time through buf
+struct idx_stream {
+  byte *buf;
+  uint32_t pos;     // Position of next byte in file
+  uint32_t end;     // End of run being read
+  uint32_t buf_pos; // Position of page in buf when reading
+};
+
+// Index b-tree being formed from sorted entries, with a page of each
+// level in buf (level 0) and sort_buf (from third page), the last cell
+// given to a level being held back till the next one arrives
+struct idx_build {
+  struct dblog_write_context *wctx;
+  int32_t page_size;
+  uint16_t max_cell;     // 4 byte child page no. and longest entry
+  uint32_t next_page;    // Page no. of next index page to be written
+  byte levels;
+  byte max_levels;
+  byte *pending;         // max_levels cells of max_cell bytes
+  uint16_t *pending_len;
+  uint32_t *content_pos; // Start of cell content area in page of each level
+};
+
+// Appends len bytes to stream, writing page when it fills
+int write_idx_stream(struct dblog_write_context *wctx, struct idx_stream *out,
+      const byte *src, uint32_t len, int32_t page_size) {
+  while (len) {
+    uint32_t offset = out->pos % page_size;
+    uint32_t avail = page_size - offset;
+    if (avail > len)
+      avail = len;
+    memcpy(out->buf + offset, src, avail);
+    src += avail;
+    out->pos += avail;
+    len -= avail;
+    if (offset + avail == (uint32_t) page_size) {
+      if ((wctx->write_fn)(wctx, out->buf, out->pos - page_size, page_size) != page_size)
+        return DBLOG_RES_WRITE_ERR;
+    }
+  }
+  return DBLOG_RES_OK;
+}
+
+// Writes page partially filled by write_idx_stream()
+int flush_idx_stream(struct dblog_write_context *wctx, struct idx_stream *out,
+      int32_t page_size) {
+  uint32_t offset = out->pos % page_size;
+  if (offset && (wctx->write_fn)(wctx, out->buf, out->pos - offset, page_size) != page_size)
+    return DBLOG_RES_WRITE_ERR;
+  return DBLOG_RES_OK;
+}
+
+// Reads len bytes from stream, reading page as needed
+int read_idx_stream(struct dblog_write_context *wctx, struct idx_stream *in,
+      byte *dst, uint32_t len, int32_t page_size) {
+  while (len) {
+    uint32_t page_pos = in->pos - in->pos % page_size;
+    if (in->buf_pos != page_pos) {
+      int res = read_bytes_wctx(wctx, in->buf, page_pos, page_size);
+      if (res)
+        return res;
+      in->buf_pos = page_pos;
+    }
+    uint32_t avail = page_pos + page_size - in->pos;
+    if (avail > len)
+      avail = len;
+    memcpy(dst, in->buf + in->pos - page_pos, avail);
+    dst += avail;
+    in->pos += avail;
+    len -= avail;
+  }
+  return DBLOG_RES_OK;
+}
+
+// Positions stream at entries of run at given position, preceded
+// by its length. Run is taken as empty if pos is not before runs_end
+int open_idx_run(struct dblog_write_context *wctx, struct idx_stream *in,
+      uint32_t pos, uint32_t runs_end, int32_t page_size) {
+  in->pos = in->end = pos;
+  if (pos >= runs_end)
+    return DBLOG_RES_OK;
+  byte len_buf[4];
+  int res = read_idx_stream(wctx, in, len_buf, 4, page_size);
+  if (res)
+    return res;
+  in->end = in->pos + read_uint32(len_buf);
+  return DBLOG_RES_OK;
+}
+
+// Reads next entry of run into entry and sets its length
+// or 0 if there are no more entries
+int read_idx_entry(struct dblog_write_context *wctx, struct idx_stream *in,
+      byte *entry, uint16_t *out_len, int32_t page_size) {
+  *out_len = 0;
+  if (in->pos >= in->end)
+    return DBLOG_RES_OK;
+  int8_t vint_len = 0;
+  do {
+    int res = read_idx_stream(wctx, in, entry + vint_len, 1, page_size);
+    if (res)
+      return res;
+  } while ((entry[vint_len++] & 0x80) && vint_len < 3);
+  uint16_t payload = read_vint16(entry, NULL);
+  int res = read_idx_stream(wctx, in, entry + vint_len, payload, page_size);
+  if (res)
+    return res;
+  *out_len = vint_len + payload;
+  return DBLOG_RES_OK;
+}
+
+// Sorts given entries and writes them to stream as a run
+// preceded by its length
+int write_idx_run(struct dblog_write_context *wctx, struct idx_stream *out,
+      byte **entries, uint32_t count, int32_t page_size) {
+  qsort(entries, count, sizeof(byte *), compare_idx_ptrs);
+  uint32_t run_len = 0;
+  for (uint32_t i = 0; i < count; i++)
+    run_len += idx_entry_len(entries[i]);
+  byte len_buf[4];
+  write_uint32(len_buf, run_len);
+  int res = write_idx_stream(wctx, out, len_buf, 4, page_size);
+  for (uint32_t i = 0; i < count && !res; i++)
+    res = write_idx_stream(wctx, out, entries[i], idx_entry_len(entries[i]), page_size);
+  return res;
+}
+
+// Forms index entries (value of given column and rowid) of rows in
+// all leaf pages, sorting as many as fit in sort_buf at a time (but
+// for its last page used to write them) and writes the sorted runs
+// one after another from pos. Sets total length and no. of runs
+int form_idx_runs(struct idx_build *ib, int col_idx, uint32_t first_leaf_page,
+      uint32_t leaf_count, uint16_t max_payload, uint32_t pos,
+      uint32_t *out_len, uint32_t *out_run_count) {
+  struct dblog_write_context *wctx = ib->wctx;
+  int32_t page_size = ib->page_size;
+  byte *area = wctx->sort_buf;
+  uint32_t area_len = (wctx->sort_buf_pages - 1) * page_size;
+  byte **ptrs = (byte **) (area + area_len); // grow downwards
+  struct idx_stream out = {area + area_len, pos, 0, 0};
+  uint32_t used = 0;
+  uint32_t count = 0;
+  byte entry[ib->max_cell];
+  *out_run_count = 0;
+  int res;
+  for (uint32_t n = 1; n <= leaf_count; n++) {
+    uint32_t page_no = (n + first_leaf_page - 2) % leaf_count + 1;
+    uint32_t rowid;
+    // pages left out of the table by finalize are left out here too
+    res = get_last_rowid(wctx, page_no, page_size, &rowid, 1);
+    if (res == DBLOG_RES_INV_CHKSUM || res == DBLOG_RES_NOT_FOUND)
+      continue;
+    if (res)
+      return res;
+    res = read_bytes_wctx(wctx, wctx->buf, page_no * page_size, page_size);
+    if (res)
+      return res;
+    uint16_t rec_count = read_uint16(wctx->buf + 3);
+    for (uint16_t i = 0; i < rec_count; i++) {
+      uint16_t rec_pos = read_uint16(wctx->buf + 8 + i * 2);
+      byte *data_ptr;
+      uint16_t rec_len;
+      uint16_t hdr_len;
+      int8_t vint_len;
+      byte *hdr_ptr = locate_column(wctx->buf + rec_pos, col_idx,
+              &data_ptr, &rec_len, &hdr_len, page_size - rec_pos);
+      uint32_t col_type = (hdr_ptr ? read_vint32(hdr_ptr, &vint_len) : 0);
+      rowid = read_vint32(wctx->buf + rec_pos + LEN_OF_REC_LEN, &vint_len);
+      uint16_t len = form_idx_entry(entry, col_type, data_ptr, rowid, max_payload);
+      if (!len)
+        return DBLOG_RES_TOO_LONG;
+      if (used + len + (count + 1) * sizeof(byte *) > area_len) {
+        res = write_idx_run(wctx, &out, ptrs - count, count, page_size);
+        if (res)
+          return res;
+        (*out_run_count)++;
+        used = count = 0;
+      }
+      memcpy(area + used, entry, len);
+      *(ptrs - ++count) = area + used;
+      used += len;
+    }
+  }
+  if (count) {
+    res = write_idx_run(wctx, &out, ptrs - count, count, page_size);
+    if (res)
+      return res;
+    (*out_run_count)++;
+  }
+  res = flush_idx_stream(wctx, &out, page_size);
+  *out_len = out.pos - pos;
+  return res;
+}
+
+// Returns buffer having page of given level of index
+byte *idx_level_buf(struct idx_build *ib, byte level) {
+  return level ? ib->wctx->sort_buf + (level + 1) * ib->page_size : ib->wctx->buf;
+}
+
+// Initializes page of given level as index b-tree leaf (level 0)
+// or interior page
+void init_idx_page(struct idx_build *ib, byte level) {
+  byte *buf = idx_level_buf(ib, level);
+  memset(buf, '\0', ib->page_size);
+  buf[0] = (level ? 2 : 10);
+  ib->content_pos[level] = ib->page_size - ib->wctx->page_resv_bytes;
+}
+
+// Writes page of given level as next index page
+// and initializes it for further cells
+int write_idx_page(struct idx_build *ib, byte level, uint32_t *out_page_no) {
+  byte *buf = idx_level_buf(ib, level);
+  write_uint16(buf + 5, ib->content_pos[level]); // 65536 written as 0
+  *out_page_no = ib->next_page++;
+  if ((ib->wctx->write_fn)(ib->wctx, buf, *out_page_no * ib->page_size,
+          ib->page_size) != ib->page_size)
+    return DBLOG_RES_WRITE_ERR;
+  init_idx_page(ib, level);
+  return DBLOG_RES_OK;
+}
+
+int add_idx_cell(struct idx_build *ib, byte level, byte *cell, uint16_t len);
+
+// Adds cell to page of given level. If it does not fit, the page
+// is written and the entry of the cell moves up to the next level
+// pointing to the page written, the child page of the cell becoming
+// right most pointer. For the last cell of a level, the last cell
+// of the page moves up instead, so that the given cell has a page
+int place_idx_cell(struct idx_build *ib, byte level, byte *cell,
+      uint16_t len, byte is_last) {
+  byte *buf = idx_level_buf(ib, level);
+  byte child_len = (level ? 4 : 0);
+  uint16_t ptr_pos = (level ? 12 : 8);
+  uint16_t count = read_uint16(buf + 3);
+  if ((uint32_t) ptr_pos + (count + 1) * 2 + len > ib->content_pos[level]) {
+    byte *up_cell = cell;
+    uint16_t up_len = len;
+    if (is_last) {
+      count--;
+      up_cell = buf + read_uint16(buf + ptr_pos + count * 2);
+      up_len = child_len + idx_entry_len(up_cell + child_len);
+      write_uint16(buf + 3, count);
+      ib->content_pos[level] += up_len;
+    }
+    byte sep[ib->max_cell];
+    memcpy(sep + 4, up_cell + child_len, up_len - child_len);
+    if (level)
+      memcpy(buf + 8, up_cell, 4);
+    uint32_t page_no;
+    int res = write_idx_page(ib, level, &page_no);
+    if (res)
+      return res;
+    write_uint32(sep, page_no + 1);
+    res = add_idx_cell(ib, level + 1, sep, 4 + up_len - child_len);
+    if (res)
+      return res;
+    if (!is_last)
+      return DBLOG_RES_OK;
+    count = 0;
+  }
+  ib->content_pos[level] -= len;
+  memcpy(buf + ib->content_pos[level], cell, len);
+  write_uint16(buf + ptr_pos + count * 2, ib->content_pos[level]);
+  write_uint16(buf + 3, count + 1);
+  return DBLOG_RES_OK;
+}
+
+// Gives cell to given level of index, placing the one held back
+// Returns DBLOG_RES_TOO_LONG if more levels are needed than
+// what sort_buf can hold
+int add_idx_cell(struct idx_build *ib, byte level, byte *cell, uint16_t len) {
+  if (level >= ib->max_levels)
+    return DBLOG_RES_TOO_LONG;
+  if (level == ib->levels) {
+    init_idx_page(ib, level);
+    ib->pending_len[level] = 0;
+    ib->levels++;
+  }
+  byte *pending = ib->pending + level * ib->max_cell;
+  if (ib->pending_len[level]) {
+    int res = place_idx_cell(ib, level, pending, ib->pending_len[level], 0);
+    if (res)
+      return res;
+  }
+  memcpy(pending, cell, len);
+  ib->pending_len[level] = len;
+  return DBLOG_RES_OK;
+}
+
+// Places cells held back and writes last page of each level, which
+// is the right most child of the last page of the level above
+int finish_idx(struct idx_build *ib, uint32_t *out_root_page) {
+  if (!ib->levels) { // no rows
+    init_idx_page(ib, 0);
+    ib->pending_len[0] = 0;
+    ib->levels = 1;
+  }
+  uint32_t child_page = 0;
+  for (byte level = 0; level < ib->levels; level++) {
+    if (ib->pending_len[level]) {
+      int res = place_idx_cell(ib, level, ib->pending + level * ib->max_cell,
+                  ib->pending_len[level], 1);
+      if (res)
+        return res;
+      ib->pending_len[level] = 0;
+    }
+    if (level)
+      write_uint32(idx_level_buf(ib, level) + 8, child_page + 1);
+    int res = write_idx_page(ib, level, &child_page);
+    if (res)
+      return res;
+  }
+  *out_root_page = child_page;
+  return DBLOG_RES_OK;
+}
+
+// Merges entries of sorted runs a and b into a run in out
+// or into index being formed if out is NULL
+int merge_idx_runs(struct idx_build *ib, struct idx_stream *a,
+      struct idx_stream *b, struct idx_stream *out) {
+  struct dblog_write_context *wctx = ib->wctx;
+  int32_t page_size = ib->page_size;
+  byte entry_a[ib->max_cell];
+  byte entry_b[ib->max_cell];
+  uint16_t len_a, len_b;
+  int res = read_idx_entry(wctx, a, entry_a, &len_a, page_size);
+  if (!res)
+    res = read_idx_entry(wctx, b, entry_b, &len_b, page_size);
+  while (!res && (len_a || len_b)) {
+    byte from_a = (len_a && (!len_b || compare_idx_entries(entry_a, entry_b) <= 0));
+    byte *entry = (from_a ? entry_a : entry_b);
+    uint16_t *len = (from_a ? &len_a : &len_b);
+    if (out)
+      res = write_idx_stream(wctx, out, entry, *len, page_size);
+    else
+      res = add_idx_cell(ib, 0, entry, *len);
+    if (!res)
+      res = read_idx_entry(wctx, from_a ? a : b, entry, len, page_size);
+  }
+  return res;
+}
+
+// Merges runs from src in pairs into half as many runs from dst
+// using first two pages of sort_buf for reading and buf for writing
+int merge_idx_pass(struct idx_build *ib, uint32_t src, uint32_t src_len,
+      uint32_t dst, uint32_t *out_len, uint32_t *run_count) {
+  struct dblog_write_context *wctx = ib->wctx;
+  int32_t page_size = ib->page_size;
+  struct idx_stream a = {wctx->sort_buf, 0, 0, DBLOG_NO_PAGE};
+  struct idx_stream b = {wctx->sort_buf + page_size, 0, 0, DBLOG_NO_PAGE};
+  struct idx_stream out = {wctx->buf, dst, 0, 0};
+  uint32_t pos = src;
+  *run_count = 0;
+  while (pos < src + src_len) {
+    int res = open_idx_run(wctx, &a, pos, src + src_len, page_size);
+    if (!res)
+      res = open_idx_run(wctx, &b, a.end, src + src_len, page_size);
+    if (res)
+      return res;
+    pos = b.end;
+    byte len_buf[4];
+    write_uint32(len_buf, (a.end - a.pos) + (b.end - b.pos));
+    res = write_idx_stream(wctx, &out, len_buf, 4, page_size);
+    if (!res)
+      res = merge_idx_runs(ib, &a, &b, &out);
+    if (res)
+      return res;
+    (*run_count)++;
+  }
+  *out_len = out.pos - dst;
+  return flush_idx_stream(wctx, &out, page_size);
+}
+
+// Finds name of column at given index in CREATE TABLE script
+// Returns NULL if not found
+const byte *locate_col_name(const byte *script, uint16_t script_len,
+      int col_idx, uint16_t *out_len) {
+  const byte *end = script + script_len;
+  const byte *ptr = (const byte *) memchr(script, '(', script_len);
+  if (ptr == NULL)
+    return NULL;
+  ptr++;
+  for (int i = 0; ptr < end; i++) {
+    while (ptr < end && (*ptr == ' ' || *ptr == '\t' || *ptr == '\r' || *ptr == '\n'))
+      ptr++;
+    const byte *name = ptr;
+    byte quote = (*ptr == '"' || *ptr == '`' ? *ptr : (*ptr == '[' ? ']' : 0));
+    if (quote) {
+      while (++ptr < end && *ptr != quote)
+        ;
+      ptr++;
+    } else {
+      while (ptr < end && *ptr > ' ' && *ptr != ',' && *ptr != '(' && *ptr != ')')
+        ptr++;
+    }
+    if (ptr > end)
+      return NULL;
+    if (i == col_idx) {
+      *out_len = ptr - name;
+      return *out_len ? name : NULL;
+    }
+    int depth = 0;
+    while (ptr < end && (depth || (*ptr != ',' && *ptr != ')'))) {
+      depth += (*ptr == '(' ? 1 : (*ptr == ')' ? -1 : 0));
+      ptr++;
+    }
+    if (ptr >= end || *ptr == ')')
+      return NULL;
+    ptr++;
+  }
+  return NULL;
+}
+
+// Locates name of indexed column in table script
+// of schema table in first page (buf)
+const byte *locate_index_col(byte *buf, int col_idx, int32_t page_size,
+      uint16_t *out_len) {
+  uint16_t rec_pos = read_uint16(buf + 108);
+  uint32_t script_type;
+  const byte *script = (const byte *) get_col_val(buf, rec_pos, 4,
+                          &script_type, page_size - rec_pos);
+  if (script == NULL || script_type < 13 || !(script_type % 2))
+    return NULL;
+  return locate_col_name(script, dblog_derive_data_len(script_type),
+            col_idx, out_len);
+}
+
+// Adds record of index as second row of schema table in first page (buf)
+// as CREATE INDEX <table>_idx<col_idx + 1> ON <table> (<column>)
+int add_index_rec(struct dblog_write_context *wctx, int col_idx,
+      uint32_t root_page, int32_t page_size) {
+  byte *buf = wctx->buf;
+  uint16_t rec_pos = read_uint16(buf + 108);
+  uint32_t tbl_type;
+  const byte *tbl_name = (const byte *) get_col_val(buf, rec_pos, 2,
+                            &tbl_type, page_size - rec_pos);
+  uint16_t col_len;
+  const byte *col_name = locate_index_col(buf, col_idx, page_size, &col_len);
+  if (tbl_name == NULL || col_name == NULL)
+    return DBLOG_RES_NOT_FOUND;
+  uint16_t tbl_len = dblog_derive_data_len(tbl_type);
+  char suffix[16];
+  uint16_t suffix_len = sprintf(suffix, "_idx%d", col_idx + 1);
+  uint16_t name_len = tbl_len + suffix_len;
+  uint16_t sql_len = 13 + name_len + 4 + tbl_len + 2 + col_len + 1;
+  uint32_t types[5] = {5 * 2 + 13, name_len * 2 + 13u, tbl_len * 2 + 13u,
+                       4, sql_len * 2 + 13u};
+  byte hdr_len = 1;
+  for (int i = 0; i < 5; i++)
+    hdr_len += get_vlen_of_uint32(types[i]);
+  uint16_t rec_len = hdr_len + 5 + name_len + tbl_len + 4 + sql_len;
+  uint16_t cell_len = get_vlen_of_uint32(rec_len) + 1 + rec_len;
+  uint16_t last_pos = read_uint16(buf + 105);
+  if (last_pos < 100 + 8 + 2 * 2 + cell_len)
+    return DBLOG_RES_TOO_LONG;
+  last_pos -= cell_len;
+  byte *ptr = buf + last_pos;
+  ptr += write_vint32(ptr, rec_len);
+  *ptr++ = 2; // rowid
+  *ptr++ = hdr_len;
+  for (int i = 0; i < 5; i++)
+    ptr += write_vint32(ptr, types[i]);
+  memcpy(ptr, "index", 5);
+  ptr += 5;
+  byte *name = ptr;
+  memcpy(ptr, tbl_name, tbl_len);
+  memcpy(ptr + tbl_len, suffix, suffix_len);
+  ptr += name_len;
+  memcpy(ptr, tbl_name, tbl_len);
+  ptr += tbl_len;
+  write_uint32(ptr, root_page);
+  ptr += 4;
+  memcpy(ptr, "CREATE INDEX ", 13);
+  ptr += 13;
+  memcpy(ptr, name, name_len);
+  ptr += name_len;
+  memcpy(ptr, " ON ", 4);
+  memcpy(ptr + 4, tbl_name, tbl_len);
+  ptr += 4 + tbl_len;
+  memcpy(ptr, " (", 2);
+  memcpy(ptr + 2, col_name, col_len);
+  ptr[2 + col_len] = ')';
+  write_uint16(buf + 103, 2);
+  write_uint16(buf + 105, last_pos);
+  write_uint16(buf + 110, last_pos);
+  return DBLOG_RES_OK;
+}
+
+// See .h file for API description
+int dblog_finalize_with_index(struct dblog_write_context *wctx, int col_idx) {
+
+  if (wctx->sort_buf == NULL || wctx->sort_buf_pages < 3)
+    return DBLOG_RES_ERR;
+  // key directory, if any, is written after the index
+  byte key_dir_col = wctx->key_dir_col;
+  wctx->key_dir_col = 0;
+  int res = dblog_finalize(wctx);
+  wctx->key_dir_col = key_dir_col;
+  if (res)
+    return res;
+
+  int32_t page_size = get_pagesize(wctx->page_size_exp);
+  if (wctx->buf[71] >> 5)
+    return DBLOG_RES_ERR; // not available with more than one table
+  if (read_uint16(wctx->buf + 103) > 1)
+    return DBLOG_RES_OK; // already has index
+  uint16_t col_len;
+  if (locate_index_col(wctx->buf, col_idx, page_size, &col_len) == NULL)
+    return DBLOG_RES_NOT_FOUND;
+  uint32_t first_leaf_page = read_uint32(wctx->buf + 72);
+  uint32_t leaf_count = read_uint32(wctx->buf + 60);
+  if (first_leaf_page > 1)
+    leaf_count = get_max_pages(wctx->buf[71] & 0x1F);
+  else
+    first_leaf_page = 1;
+  uint32_t scratch_page = read_uint32(wctx->buf + 28);
+  uint32_t free_trunk = read_uint32(wctx->buf + 32);
+  uint32_t free_total = read_uint32(wctx->buf + 36);
+
+  // entries longer than this would need overflow pages
+  uint16_t max_payload = (page_size - wctx->page_resv_bytes - 12) * 64 / 255 - 23;
+  byte max_levels = wctx->sort_buf_pages - 1;
+  struct idx_build ib;
+  ib.wctx = wctx;
+  ib.page_size = page_size;
+  ib.max_cell = 4 + 3 + max_payload;
+  ib.levels = 0;
+  ib.max_levels = max_levels;
+  byte pending[max_levels * ib.max_cell];
+  uint16_t pending_len[max_levels];
+  uint32_t content_pos[max_levels];
+  ib.pending = pending;
+  ib.pending_len = pending_len;
+  ib.content_pos = content_pos;
+
+  uint32_t src = scratch_page * page_size;
+  uint32_t runs_len, run_count;
+  res = form_idx_runs(&ib, col_idx, first_leaf_page, leaf_count, max_payload,
+          src, &runs_len, &run_count);
+  if (res)
+    return res;
+  // runs are merged back and forth between two regions of scratch pages
+  uint32_t region_pages = (runs_len + page_size - 1) / page_size;
+  uint32_t dst = src + region_pages * page_size;
+  byte regions = 1;
+  while (run_count > 2) {
+    regions = 2;
+    res = merge_idx_pass(&ib, src, runs_len, dst, &runs_len, &run_count);
+    if (res)
+      return res;
+    uint32_t swap_pos = src;
+    src = dst;
+    dst = swap_pos;
+  }
+  struct idx_stream a = {wctx->sort_buf, 0, 0, DBLOG_NO_PAGE};
+  struct idx_stream b = {wctx->sort_buf + page_size, 0, 0, DBLOG_NO_PAGE};
+  res = open_idx_run(wctx, &a, src, src + runs_len, page_size);
+  if (!res)
+    res = open_idx_run(wctx, &b, a.end, src + runs_len, page_size);
+  ib.next_page = scratch_page + regions * region_pages;
+  uint32_t root_page;
+  if (!res)
+    res = merge_idx_runs(&ib, &a, &b, NULL);
+  if (!res)
+    res = finish_idx(&ib, &root_page);
+  uint32_t free_count = regions * region_pages;
+  if (!res)
+    res = write_free_pages(wctx, scratch_page, free_count, free_trunk, page_size);
+  if (!res)
+    res = read_bytes_wctx(wctx, wctx->buf, 0, page_size);
+  if (!res)
+    res = add_index_rec(wctx, col_idx, root_page + 1, page_size);
+  if (res)
+    return res;
+  write_uint32(wctx->buf + 28, ib.next_page); // update page_count
+  write_uint32(wctx->buf + 32, free_count ? scratch_page + 1 : free_trunk);
+  write_uint32(wctx->buf + 36, free_total + free_count);
+  memset(wctx->buf + 90, '\0', 2); // key directory if any is overwritten
+  res = write_page(wctx, 0, page_size);
+  if (res)
+    return res;
+  if (key_dir_col) {
+    res = finalize_key_dir(wctx, first_leaf_page, leaf_count, page_size);
+    if (!res)
+      res = write_page(wctx, 0, page_size);
+  }
+  return res;
+}
+
+// See .h file for API description
+int dblog_not_finalized(struct dblog_write_context *wctx) {
+  int res = read_bytes_wctx(wctx, wctx->buf, 0, 72);
+  if (res)
+    return res;
+  if (memcmp(wctx->buf, sqlite_sig, 16) == 0)
+    return DBLOG_RES_OK;
+  return DBLOG_RES_NOT_FINALIZED;
+}
+
+int32_t dblog_read_page_size(struct dblog_write_context *wctx) {
+  int res = read_bytes_wctx(wctx, wctx->buf, 0, 72);
+  if (res)
+    return res;
+  if (check_signature(wctx->buf))
     return DBLOG_RES_INVALID_SIG;
   int32_t page_size = read_uint16(wctx->buf + 16);
   wctx->page_size_exp = get_page_size_exp(page_size);
@@ -1044,14 +3860,68 @@ int32_t dblog_read_page_size(struct dblog_write_context *wctx) {
 int dblog_recover(struct dblog_write_context *wctx) {
   wctx->state = DBLOG_ST_TO_RECOVER;
   wctx->cur_write_page = 0;
+#if DBLOG_CFG_MULTI_TABLE
+  wctx->main_wctx = NULL;
+  wctx->next_table = NULL;
+#endif
   int res = dblog_finalize(wctx);
   if (res)
     return res;
   return DBLOG_RES_OK;
 }
 
+// Positions at last leaf page of table for appending rows
+// When there is more than one table, it is the last page marked
+// with the table before last page of all tables, if any
+int load_last_leaf(struct dblog_write_context *wctx, int32_t page_size) {
+  int res;
+#if DBLOG_CFG_MULTI_TABLE
+  if (has_tables(wctx)) {
+    struct dblog_write_context *main_wctx = main_table(wctx);
+    uint32_t page_no = main_wctx->last_page;
+    byte page_table = wctx->table_idx + 1;
+    uint16_t rec_count = 0;
+    for (; page_no; page_no--) {
+      res = read_page_table(wctx, page_no, page_size, &page_table, &rec_count);
+      if (res && res != DBLOG_RES_NOT_FOUND)
+        return res;
+      if (res == DBLOG_RES_OK && page_table == wctx->table_idx)
+        break;
+    }
+    if (page_no == 0 || rec_count == 0) {
+      memset(wctx->buf, '\0', page_size);
+      start_leaf_pages(wctx, page_no ? page_no : ++main_wctx->last_page);
+      return DBLOG_RES_OK;
+    }
+    wctx->cur_write_page = page_no;
+  }
+#endif
+  res = get_last_rowid(wctx, wctx->cur_write_page, page_size, &wctx->cur_write_rowid, 1);
+  if (res)
+    return res;
+  res = read_bytes_wctx(wctx, wctx->buf, wctx->cur_write_page * page_size, page_size);
+  if (res)
+    return res;
+  wctx->flushed_rec_count = read_uint16(wctx->buf + 3); // same as on disk
+  mark_durable(wctx);
+#if DBLOG_CFG_FLUSH_SLOTS
+  // sequence continues from that of the copy in place
+  wctx->flush_seq = read_uint32(wctx->buf + page_size - wctx->page_resv_bytes + 4);
+  wctx->flush_slot = DBLOG_SLOT_HOME;
+#endif
+  wctx->state = DBLOG_ST_WRITE_NOT_PENDING;
+#if DBLOG_CFG_WRITE_BEHIND
+  wb_start(wctx);
+#endif
+  return DBLOG_RES_OK;
+}
+
 // See .h file for API description
 int dblog_init_for_append(struct dblog_write_context *wctx) {
+  wctx->cur_write_rowid = 0;
+  wctx->state = DBLOG_ST_WRITE_NOT_PENDING; // till last leaf is loaded
+  mark_durable(wctx);
+  wctx->schema_hdr = NULL;
   int res = read_bytes_wctx(wctx, wctx->buf, 0, 72);
   if (res)
     return res;
@@ -1069,37 +3939,166 @@ int dblog_init_for_append(struct dblog_write_context *wctx) {
   wctx->cur_write_page = read_uint32(wctx->buf + 60);
   if (wctx->cur_write_page == 0)
     return DBLOG_RES_NOT_FINALIZED;
+  byte table_count = (wctx->buf[71] >> 5) + 1;
+#if DBLOG_CFG_MULTI_TABLE
+  wctx->main_wctx = NULL;
+  wctx->next_table = NULL;
+  wctx->table_idx = 0;
+  wctx->table_count = table_count;
+  wctx->last_page = wctx->cur_write_page;
+#else
+  if (table_count > 1)
+    return DBLOG_RES_ERR;
+#endif
+#if DBLOG_CFG_STREAM_BTREE
+  if (has_tables(wctx))
+    wctx->tree_depth = DBLOG_TREE_OFF;
+  else if (wctx->tree_levels) {
+    byte *data_ptr = locate_col_root_page(wctx->buf, page_size - wctx->page_resv_bytes, 0);
+    if (data_ptr == NULL || load_tree(wctx, read_uint32(data_ptr) - 1, page_size))
+      wctx->tree_depth = DBLOG_TREE_OFF;
+  } else
+    wctx->tree_depth = DBLOG_TREE_OFF; // pages may have been streamed earlier
+#endif
+  wctx->max_pages_exp = wctx->buf[71] & 0x1F;
+  if (wctx->buf[70] != wctx->zone_col_count) // zone maps cannot change
+    return DBLOG_RES_ERR;
+#if DBLOG_CFG_PAGE_LAYOUT
+  wctx->layout_page = read_uint32(wctx->buf + 80);
+  wctx->layout_rowid = read_uint32(wctx->buf + 84);
+  wctx->layout_rows = read_uint16(wctx->buf + 88);
+#else
+  memset(wctx->buf + 80, '\0', 10); // layout is not tracked for rows appended
+#endif
   memcpy(wctx->buf, dblog_sig, 16);
   write_uint32(wctx->buf + 60, 0);
+  memset(wctx->buf + 72, '\0', 8); // first leaf page and rowid
+  memset(wctx->buf + 90, '\0', 2); // key directory to be overwritten
+  // index and its free pages (see dblog_finalize_with_index()) too
+  memset(wctx->buf + 32, '\0', 8);
+  // table rows are followed by index row, if any
+  write_uint16(wctx->buf + 103, table_count);
+  write_uint16(wctx->buf + 105, read_uint16(wctx->buf + 108 + (table_count - 1) * 2));
   res = write_page(wctx, 0, page_size);
   if (res)
     return res;
-  res = get_last_rowid(wctx, wctx->cur_write_page, page_size, &wctx->cur_write_rowid);
-  if (res)
-    return res;
-  res = read_bytes_wctx(wctx, wctx->buf, wctx->cur_write_page * page_size, page_size);
-  if (res)
-    return res;
-  wctx->state = DBLOG_ST_WRITE_NOT_PENDING;
-  return DBLOG_RES_OK;
+  return load_last_leaf(wctx, page_size);
+}
+
+#if DBLOG_CFG_MULTI_TABLE
+// See .h file for API description
+int dblog_init_table_for_append(struct dblog_write_context *wctx,
+      struct dblog_write_context *main_wctx, byte table_idx) {
+  if (main_wctx->main_wctx || table_idx == 0 || table_idx >= main_wctx->table_count
+        || wctx->zone_col_count != main_wctx->zone_col_count)
+    return DBLOG_RES_ERR;
+  struct dblog_write_context *table = main_wctx->next_table;
+  for (; table; table = table->next_table) {
+    if (table->table_idx == table_idx)
+      return DBLOG_RES_ERR; // already opened
+  }
+  share_file(wctx, main_wctx);
+  join_table(wctx, main_wctx, table_idx);
+  return load_last_leaf(wctx, get_pagesize(wctx->page_size_exp));
+}
+#endif
+
+// Returns 1 if the database being read has more than one table
+byte has_tables_rctx(struct dblog_read_context *rctx) {
+#if DBLOG_CFG_MULTI_TABLE
+  return rctx->table_count > 1;
+#else
+  (void) rctx;
+  return 0;
+#endif
+}
+
+// Returns 1 if page having given header is a leaf page of the table
+// being read, that is marked with it when there is more than one table
+// (see mark_table()) and has records. Returns 0 otherwise
+byte is_table_leaf(struct dblog_read_context *rctx, byte *head_buf,
+      uint32_t page_no, int32_t page_size) {
+  if (head_buf[0] != 13)
+    return 0;
+#if DBLOG_CFG_MULTI_TABLE
+  if (rctx->table_count < 2)
+    return 1;
+  if (read_uint16(head_buf + 3) == 0)
+    return 0;
+  byte mark_buf[1];
+  byte *mark = get_bytes_rctx(rctx, mark_buf, page_no * page_size
+                 + table_mark_pos(page_size, rctx->zone_col_count), 1);
+  return mark && *mark == rctx->table_idx;
+#else
+  (void) rctx;
+  (void) page_no;
+  (void) page_size;
+  return 1;
+#endif
 }
 
 // Reads current page
 int read_cur_page(struct dblog_read_context *rctx) {
   int32_t page_size = get_pagesize(rctx->page_size_exp);
-  int res = read_bytes_rctx(rctx, rctx->buf, rctx->cur_page * page_size, page_size);
+  int res = read_page_rctx(rctx, rctx->cur_page, page_size);
   if (res)
     return res;
   if (rctx->buf[0] != 13)
     return DBLOG_RES_NOT_FOUND;
+#if DBLOG_CFG_MULTI_TABLE
+  if (rctx->table_count > 1 && (read_uint16(rctx->buf + 3) == 0
+        || rctx->buf[table_mark_pos(page_size, rctx->zone_col_count)] != rctx->table_idx))
+    return DBLOG_RES_NOT_FOUND; // see is_table_leaf()
+#endif
   return DBLOG_RES_OK;
 }
 
+// Reads current page, moving forward (dir = 1) or backward (dir = -1)
+// past any interior page formed in between leaf pages during append
+// and leaf pages of other tables, if there is more than one
+int read_cur_leaf_page(struct dblog_read_context *rctx, int8_t dir) {
+  int res;
+  while ((res = read_cur_page(rctx)) == DBLOG_RES_NOT_FOUND
+           && (rctx->buf[0] == 5 || has_tables_rctx(rctx))) {
+    if (dir > 0 ? (rctx->last_leaf_page && rctx->cur_page >= rctx->last_leaf_page)
+                : rctx->cur_page <= 1)
+      break;
+    rctx->cur_page += dir;
+  }
+  return res;
+}
+
 // See .h file for API description
 int dblog_read_init(struct dblog_read_context *rctx) {
-  int res = read_bytes_rctx(rctx, rctx->buf, 0, 72);
-  if (res)
-    return res;
+#if DBLOG_CFG_PAGE_CACHE
+  for (byte i = 0; i < rctx->cache_frame_count; i++)
+    rctx->cache_frames[i].page_no = DBLOG_NO_PAGE;
+#endif
+#if DBLOG_CFG_PAGE_CACHE || DBLOG_CFG_FENCE_CACHE
+  rctx->cache_tick = 0;
+#endif
+#if DBLOG_CFG_COL_CACHE
+  rctx->col_cache_buf = NULL;
+#endif
+#if DBLOG_CFG_READ_AHEAD
+  rctx->ahead_count = 0;
+#endif
+#if DBLOG_CFG_FENCE_CACHE
+  rctx->fence_cache_used = 0;
+#endif
+  int res;
+#if DBLOG_CFG_MMAP
+  if (rctx->map_base) {
+    rctx->buf = map_bytes_rctx(rctx, 0, 100);
+    if (rctx->buf == NULL)
+      return DBLOG_RES_READ_ERR;
+  } else
+#endif
+  {
+    res = read_bytes_rctx(rctx, rctx->buf, 0, 100);
+    if (res)
+      return res;
+  }
   if (check_signature(rctx->buf))
     return DBLOG_RES_INVALID_SIG;
   int32_t page_size = read_uint16(rctx->buf + 16);
@@ -1108,13 +4107,85 @@ int dblog_read_init(struct dblog_read_context *rctx) {
     return DBLOG_RES_INVALID_SIG;
   rctx->page_resv_bytes = read_uint8(rctx->buf + 20);
   rctx->last_leaf_page = read_uint32(rctx->buf + 60);
+  rctx->max_pages_exp = rctx->buf[71] & 0x1F;
+  rctx->first_leaf_page = read_uint32(rctx->buf + 72);
+  if (rctx->first_leaf_page == 0)
+    rctx->first_leaf_page = 1;
+#if DBLOG_CFG_PAGE_LAYOUT
+  rctx->layout_page = read_uint32(rctx->buf + 80);
+  rctx->layout_rowid = read_uint32(rctx->buf + 84);
+  rctx->layout_rows = read_uint16(rctx->buf + 88);
+#endif
+  rctx->key_dir_col = rctx->buf[90];
+  rctx->key_dir_entry_len = rctx->buf[91];
+  rctx->key_dir_page = read_uint32(rctx->buf + 32) - 1; // see finalize_key_dir()
+  rctx->zone_col_count = rctx->buf[70];
+#if DBLOG_CFG_MULTI_TABLE
+  rctx->table_count = (rctx->buf[71] >> 5) + 1;
+  if (rctx->table_idx >= rctx->table_count)
+    return DBLOG_RES_NOT_FOUND;
+#else
+  if (rctx->buf[71] >> 5)
+    return DBLOG_RES_ERR; // leaf pages of tables are not told apart
+#endif
   rctx->cur_page = 0;
   rctx->root_page = 0; // to be read when needed
+  rctx->index_root = 0;
   return DBLOG_RES_OK;
 }
 
+#if DBLOG_CFG_COL_CACHE
+// Decodes header of current row into col_offsets and col_types
+// unless already done for the row and returns no. of columns
+// See https://www.sqlite.org/fileformat.html#record_format
+int decode_cur_row(struct dblog_read_context *rctx) {
+  if (rctx->col_cache_buf == rctx->buf && rctx->col_cache_page == rctx->cur_page
+        && rctx->col_cache_rec_pos == rctx->cur_rec_pos)
+    return rctx->col_cache_count;
+  rctx->col_cache_buf = rctx->buf;
+  rctx->col_cache_page = rctx->cur_page;
+  rctx->col_cache_rec_pos = rctx->cur_rec_pos;
+  rctx->col_cache_count = -1;
+  uint16_t rec_data_pos = read_uint16(rctx->buf + 8 + rctx->cur_rec_pos * 2);
+  int32_t limit = get_pagesize(rctx->page_size_exp) - rec_data_pos;
+  byte *rec_ptr = rctx->buf + rec_data_pos;
+  int8_t vint_len;
+  uint16_t rec_len = read_vint16(rec_ptr, &vint_len);
+  byte *hdr_ptr = rec_ptr + vint_len;
+  read_vint32(hdr_ptr, &vint_len);
+  hdr_ptr += vint_len;
+  if (rec_len + (hdr_ptr - rec_ptr) > limit)
+    return -1; // corruption
+  uint16_t hdr_len = read_vint16(hdr_ptr, &vint_len);
+  if (hdr_len > limit)
+    return -1; // corruption
+  byte *data_ptr = hdr_ptr + hdr_len;
+  byte *data_start_ptr = data_ptr;
+  hdr_ptr += vint_len;
+  int16_t col_count = 0;
+  while (hdr_ptr < data_start_ptr) {
+    uint32_t col_type_or_len = read_vint32(hdr_ptr, &vint_len);
+    hdr_ptr += vint_len;
+    if (data_ptr - rec_ptr > limit)
+      return -1; // corruption
+    if (col_count < rctx->col_cache_len) {
+      rctx->col_offsets[col_count] = data_ptr - rctx->buf;
+      rctx->col_types[col_count] = col_type_or_len;
+    }
+    data_ptr += dblog_derive_data_len(col_type_or_len);
+    col_count++;
+  }
+  rctx->col_cache_count = col_count;
+  return col_count;
+}
+#endif
+
 // See .h file for API description
 int dblog_cur_row_col_count(struct dblog_read_context *rctx) {
+#if DBLOG_CFG_COL_CACHE
+  if (rctx->col_cache_len)
+    return decode_cur_row(rctx);
+#endif
   uint16_t rec_data_pos = read_uint16(rctx->buf + 8 + rctx->cur_rec_pos * 2);
   int8_t vint_len;
   byte *ptr = rctx->buf + rec_data_pos + LEN_OF_REC_LEN;
@@ -1138,13 +4209,124 @@ const void *dblog_read_col_val(struct dblog_read_context *rctx,
      int col_idx, uint32_t *out_col_type) {
   if (rctx->cur_page == 0)
     dblog_read_first_row(rctx);
+#if DBLOG_CFG_COL_CACHE
+  if (rctx->col_cache_len) {
+    int col_count = decode_cur_row(rctx);
+    if (col_idx >= col_count)
+      return NULL;
+    if (col_idx < rctx->col_cache_len) {
+      *out_col_type = rctx->col_types[col_idx];
+      return rctx->buf + rctx->col_offsets[col_idx];
+    }
+  }
+#endif
   uint16_t rec_pos = read_uint16(rctx->buf + 8 + rctx->cur_rec_pos * 2);
   return get_col_val(rctx->buf, rec_pos, col_idx, out_col_type,
     get_pagesize(rctx->page_size_exp) - rec_pos);
 }
 
-// See .h file for API description
-const int8_t col_data_lens[] = {0, 1, 2, 3, 4, 6, 8, 8};
+// Converts big-endian 64 bit values placed in given array to native
+// Written as a plain loop of shifts so that compilers can vectorize it
+void swap_col_array(uint64_t *values, uint16_t count) {
+  for (uint16_t i = 0; i < count; i++) {
+    byte *b = (byte *) (values + i);
+    values[i] = ((uint64_t) b[0] << 56) | ((uint64_t) b[1] << 48)
+              | ((uint64_t) b[2] << 40) | ((uint64_t) b[3] << 32)
+              | ((uint64_t) b[4] << 24) | ((uint64_t) b[5] << 16)
+              | ((uint64_t) b[6] << 8) | b[7];
+  }
+}
+
+// Places value of column of given type at given row of the array
+// and clears its null bit if the type matches
+// Integers and reals are left big-endian for swap_col_array()
+void set_col_array_val(struct dblog_col_array *col, uint16_t row,
+        byte *data_ptr, uint32_t col_type_or_len) {
+  switch (col->type) {
+    case DBLOG_TYPE_INT:
+      if (col_type_or_len > 0 && col_type_or_len < 10 && col_type_or_len != 7) {
+        // sign extend from the left and copy value right-aligned
+        byte *val = (byte *) ((int64_t *) col->values + row);
+        int8_t len = dblog_derive_data_len(col_type_or_len);
+        memset(val, len && (*data_ptr & 0x80) ? 0xFF : 0, 8 - len);
+        memcpy(val + 8 - len, data_ptr, len);
+        if (col_type_or_len == 9)
+          val[7] = 1;
+        break;
+      }
+      return;
+    case DBLOG_TYPE_REAL:
+      if (col_type_or_len == 7) {
+        memcpy((double *) col->values + row, data_ptr, 8);
+        break;
+      }
+      return;
+    case DBLOG_TYPE_BLOB:
+    case DBLOG_TYPE_TEXT:
+      if (col_type_or_len >= 12 && (col_type_or_len % 2) == (col->type == DBLOG_TYPE_TEXT)) {
+        ((const byte **) col->values)[row] = data_ptr;
+        if (col->lens)
+          col->lens[row] = dblog_derive_data_len(col_type_or_len);
+        break;
+      }
+      return;
+    default:
+      return;
+  }
+  col->nulls[row / 8] &= ~(1 << (row % 8));
+}
+
+// See .h file for API description
+int dblog_decode_page_columns(struct dblog_read_context *rctx,
+      struct dblog_col_array *cols, byte col_count, uint16_t max_rows) {
+  if (rctx->cur_page == 0 && dblog_read_first_row(rctx))
+    return DBLOG_RES_NOT_FOUND;
+  int32_t page_size = get_pagesize(rctx->page_size_exp);
+  uint16_t rec_count = read_uint16(rctx->buf + 3) - rctx->cur_rec_pos;
+  if (rec_count > max_rows)
+    rec_count = max_rows;
+  for (byte j = 0; j < col_count; j++)
+    memset(cols[j].nulls, 0xFF, (rec_count + 7) / 8);
+  for (uint16_t row = 0; row < rec_count; row++) {
+    uint16_t rec_data_pos = read_uint16(rctx->buf + 8 + (rctx->cur_rec_pos + row) * 2);
+    byte *rec_ptr = rctx->buf + rec_data_pos;
+    int32_t limit = page_size - rec_data_pos;
+    int8_t vint_len;
+    uint16_t rec_len = read_vint16(rec_ptr, &vint_len);
+    byte *hdr_ptr = rec_ptr + vint_len;
+    read_vint32(hdr_ptr, &vint_len);
+    hdr_ptr += vint_len;
+    if (rec_len + (hdr_ptr - rec_ptr) > limit)
+      return DBLOG_RES_MALFORMED;
+    uint16_t hdr_len = read_vint16(hdr_ptr, &vint_len);
+    if (hdr_len > limit)
+      return DBLOG_RES_MALFORMED;
+    byte *data_ptr = hdr_ptr + hdr_len;
+    byte *data_start_ptr = data_ptr;
+    hdr_ptr += vint_len;
+    for (int col_idx = 0; hdr_ptr < data_start_ptr; col_idx++) {
+      uint32_t col_type_or_len = read_vint32(hdr_ptr, &vint_len);
+      hdr_ptr += vint_len;
+      if (data_ptr - rec_ptr > limit)
+        return DBLOG_RES_MALFORMED;
+      for (byte j = 0; j < col_count; j++) {
+        if (cols[j].col_idx == col_idx)
+          set_col_array_val(cols + j, row, data_ptr, col_type_or_len);
+      }
+      data_ptr += dblog_derive_data_len(col_type_or_len);
+    }
+  }
+  for (byte j = 0; j < col_count; j++) {
+    if (cols[j].type == DBLOG_TYPE_INT || cols[j].type == DBLOG_TYPE_REAL)
+      swap_col_array((uint64_t *) cols[j].values, rec_count);
+  }
+  if (rec_count)
+    rctx->cur_rec_pos += rec_count - 1;
+  return rec_count;
+}
+
+// See .h file for API description
+const int8_t col_data_lens[] = {0, 1, 2, 3, 4, 6, 8, 8};
 uint32_t dblog_derive_data_len(uint32_t col_type_or_len) {
   if (col_type_or_len >= 12) {
     if (col_type_or_len % 2)
@@ -1158,8 +4340,8 @@ uint32_t dblog_derive_data_len(uint32_t col_type_or_len) {
 
 // See .h file for API description
 int dblog_read_first_row(struct dblog_read_context *rctx) {
-  rctx->cur_page = 1;
-  if (read_cur_page(rctx))
+  rctx->cur_page = rctx->first_leaf_page;
+  if (read_cur_leaf_page(rctx, 1))
     return DBLOG_RES_NOT_FOUND;
   rctx->cur_rec_pos = 0;
   return DBLOG_RES_OK;
@@ -1170,10 +4352,22 @@ int dblog_read_next_row(struct dblog_read_context *rctx) {
   uint16_t rec_count = read_uint16(rctx->buf + 3);
   rctx->cur_rec_pos++;
   if (rctx->cur_rec_pos == rec_count) {
-    int32_t page_size = get_pagesize(rctx->page_size_exp);
-    rctx->cur_page++;
-    if (read_cur_page(rctx))
+    if (rctx->cur_page == rctx->last_leaf_page)
+      return DBLOG_RES_NOT_FOUND; // as next page could be first page or a copy
+    uint32_t cur_page = rctx->cur_page;
+    rctx->cur_page = next_leaf_page(rctx->cur_page, rctx->max_pages_exp);
+#if DBLOG_CFG_READ_AHEAD
+    read_ahead(rctx);
+#endif
+    if (read_cur_leaf_page(rctx, 1)) {
+      if (has_tables_rctx(rctx)) {
+        // stay at last row as pages after it are of other tables
+        rctx->cur_page = cur_page;
+        rctx->cur_rec_pos--;
+        read_cur_page(rctx);
+      }
       return DBLOG_RES_NOT_FOUND;
+    }
     rctx->cur_rec_pos = 0;
   }
   return DBLOG_RES_OK;
@@ -1182,11 +4376,20 @@ int dblog_read_next_row(struct dblog_read_context *rctx) {
 // See .h file for API description
 int dblog_read_prev_row(struct dblog_read_context *rctx) {
   if (rctx->cur_rec_pos == 0) {
-    if (rctx->cur_page == 1)
+    if (rctx->cur_page == rctx->first_leaf_page)
       return DBLOG_RES_NOT_FOUND;
+    uint32_t cur_page = rctx->cur_page;
     rctx->cur_page--;
-    if (read_cur_page(rctx))
+    if (rctx->cur_page == 0)
+      rctx->cur_page = get_max_pages(rctx->max_pages_exp);
+    if (read_cur_leaf_page(rctx, -1)) {
+      if (has_tables_rctx(rctx)) {
+        // stay at first row as pages before it are of other tables
+        rctx->cur_page = cur_page;
+        read_cur_page(rctx);
+      }
       return DBLOG_RES_NOT_FOUND;
+    }
     rctx->cur_rec_pos = read_uint16(rctx->buf + 3);
   }
   rctx->cur_rec_pos--;
@@ -1198,7 +4401,7 @@ int dblog_read_last_row(struct dblog_read_context *rctx) {
   if (rctx->last_leaf_page == 0)
     return DBLOG_RES_NOT_FINALIZED;
   rctx->cur_page = rctx->last_leaf_page;
-  if (read_cur_page(rctx))
+  if (read_cur_leaf_page(rctx, -1))
     return DBLOG_RES_NOT_FOUND;
   rctx->cur_rec_pos = read_uint16(rctx->buf + 3) - 1;
   return DBLOG_RES_OK;
@@ -1208,30 +4411,48 @@ int dblog_read_last_row(struct dblog_read_context *rctx) {
 // Reads the buffer part by part to avoid reading entire buffer into memory
 // to support low memory systems (2kb ram)
 // The underlying callback function hopefully optimizes repeated IO
-int read_last_val(struct dblog_read_context *rctx, uint32_t pos,
+// If pos is an interior page or a leaf page of another table,
+// the leaf page before it, but not before min_pos, is used
+// and pos is changed to that page
+int read_last_val(struct dblog_read_context *rctx, uint32_t *ppos, uint32_t min_pos,
       int32_t page_size, int col_idx, byte *val_at, int val_len,
       uint32_t *out_col_type, uint16_t *out_rec_pos, byte is_rowid) {
-  byte src_buf[12];
-  int res = read_bytes_rctx(rctx, src_buf, pos * page_size, 12);
-  if (res)
-    return res;
+  byte head_buf[12];
+  byte *src_buf = get_bytes_rctx(rctx, head_buf, *ppos * page_size, 12);
+  if (src_buf == NULL)
+    return DBLOG_RES_READ_ERR;
+  while (!is_table_leaf(rctx, src_buf, *ppos, page_size) && *ppos > min_pos
+           && (*src_buf == 5 || has_tables_rctx(rctx))) {
+    (*ppos)--;
+    src_buf = get_bytes_rctx(rctx, head_buf, *ppos * page_size, 12);
+    if (src_buf == NULL)
+      return DBLOG_RES_READ_ERR;
+  }
+  if (has_tables_rctx(rctx) && !is_table_leaf(rctx, src_buf, *ppos, page_size))
+    return DBLOG_RES_NOT_FOUND;
   if (*src_buf != 13)
     return DBLOG_RES_MALFORMED;
+  uint32_t pos = *ppos;
   *out_rec_pos = read_uint16(src_buf + 3) - 1;
   uint16_t last_pos = read_uint16(src_buf + 5);
-  res = read_bytes_rctx(rctx, src_buf, pos * page_size + last_pos, 12);
-  if (res)
-    return res;
+  src_buf = get_bytes_rctx(rctx, head_buf, pos * page_size + last_pos, 12);
+  if (src_buf == NULL)
+    return DBLOG_RES_READ_ERR;
   int8_t vint_len;
   uint32_t u32 = read_vint32(src_buf + 3, &vint_len);
   if (is_rowid)
     *out_col_type = u32;
   else {
     uint16_t rec_len = read_vint16(src_buf, NULL) + vint_len + LEN_OF_REC_LEN;
-    byte rec_buf[rec_len];
-    res = read_bytes_rctx(rctx, rec_buf, pos * page_size + last_pos, rec_len);
-    if (res)
-      return res;
+#if DBLOG_CFG_MMAP
+    // not copied if mapped into memory
+    byte rec_copy[rctx->map_base ? 1 : rec_len];
+#else
+    byte rec_copy[rec_len];
+#endif
+    byte *rec_buf = get_bytes_rctx(rctx, rec_copy, pos * page_size + last_pos, rec_len);
+    if (rec_buf == NULL)
+      return DBLOG_RES_READ_ERR;
     uint16_t hdr_len;
     byte *data_ptr;
     byte *hdr_ptr = locate_column(rec_buf, col_idx, &data_ptr, &rec_len, &hdr_len, rec_len);
@@ -1279,19 +4500,47 @@ uint32_t read_rowid_at(struct dblog_read_context *rctx, uint32_t rec_pos) {
 
 int read_root_page_no(struct dblog_read_context *rctx, int32_t page_size) {
   if (rctx->root_page)
-    return rctx->root_page;
-  int res = read_bytes_rctx(rctx, rctx->buf, 0, page_size);
+    return DBLOG_RES_OK;
+  int res = read_page_rctx(rctx, 0, page_size);
   if (res)
     return res;
-  byte *data_ptr = locate_col_root_page(rctx->buf, page_size - rctx->page_resv_bytes);
+#if DBLOG_CFG_MULTI_TABLE
+  byte *data_ptr = locate_col_root_page(rctx->buf, page_size - rctx->page_resv_bytes, rctx->table_idx);
+#else
+  byte *data_ptr = locate_col_root_page(rctx->buf, page_size - rctx->page_resv_bytes, 0);
+#endif
   if (data_ptr == NULL)
     return DBLOG_RES_MALFORMED;
   rctx->root_page = read_uint32(data_ptr);
   return DBLOG_RES_OK;
 }
 
+#if DBLOG_CFG_PAGE_LAYOUT
+// Reads leaf page computed from layout recorded by writer and
+// positions at given rowid if the page indeed has it
+int srch_row_by_layout(struct dblog_read_context *rctx, uint32_t rowid, int32_t page_size) {
+  if (!rctx->layout_rows || rowid < rctx->layout_rowid)
+    return DBLOG_RES_NOT_FOUND;
+  uint32_t page_no = layout_page_of(rowid, rctx->layout_page,
+          rctx->layout_rowid, rctx->layout_rows, rctx->max_pages_exp);
+  if (read_page_rctx(rctx, page_no, page_size) || *rctx->buf != 13)
+    return DBLOG_RES_NOT_FOUND;
+  uint32_t first_rowid = read_rowid_at(rctx, 0);
+  if (rowid < first_rowid || rowid - first_rowid >= read_uint16(rctx->buf + 3)
+        || read_rowid_at(rctx, rowid - first_rowid) != rowid)
+    return DBLOG_RES_NOT_FOUND;
+  rctx->cur_page = page_no;
+  rctx->cur_rec_pos = rowid - first_rowid;
+  return DBLOG_RES_OK;
+}
+#endif
+
 // See .h file for API description
 int dblog_srch_row_by_id(struct dblog_read_context *rctx, uint32_t rowid) {
+#if DBLOG_CFG_PAGE_LAYOUT
+  if (srch_row_by_layout(rctx, rowid, get_pagesize(rctx->page_size_exp)) == DBLOG_RES_OK)
+    return DBLOG_RES_OK;
+#endif
   if (rctx->last_leaf_page == 0)
     return DBLOG_RES_NOT_FINALIZED;
   int32_t page_size = get_pagesize(rctx->page_size_exp);
@@ -1303,7 +4552,7 @@ int dblog_srch_row_by_id(struct dblog_read_context *rctx, uint32_t rowid) {
     return DBLOG_RES_NOT_FINALIZED;
   do {
     srch_page--;
-    int res = read_bytes_rctx(rctx, rctx->buf, srch_page * page_size, page_size);
+    int res = read_page_rctx(rctx, srch_page, page_size);
     if (res)
       return res;
     uint32_t middle, first, size;
@@ -1337,6 +4586,22 @@ int dblog_srch_row_by_id(struct dblog_read_context *rctx, uint32_t rowid) {
   return DBLOG_RES_NOT_FOUND;
 }
 
+// Returns no. of leaf pages, which is max pages
+// if leaf pages have rolled over
+uint32_t leaf_page_count(struct dblog_read_context *rctx) {
+  if (rctx->first_leaf_page > 1)
+    return get_max_pages(rctx->max_pages_exp);
+  return rctx->last_leaf_page;
+}
+
+// Returns page no. of the nth leaf page (starting with 1)
+// taking into account pages that have rolled over
+uint32_t leaf_page_at(struct dblog_read_context *rctx, uint32_t n) {
+  if (rctx->first_leaf_page > 1)
+    return (n + rctx->first_leaf_page - 2) % get_max_pages(rctx->max_pages_exp) + 1;
+  return n;
+}
+
 // compares two binary strings and returns k, -k or 0
 // 0 meaning the two are identical. If not, k is length that matches
 int compare_bin(const byte *v1, byte len1, const byte *v2, byte len2) {
@@ -1427,47 +4692,334 @@ int compare_values(byte *val_at, uint32_t u32_at, int val_type, void *val, uint1
   return 1;
 }
 
-// See .h file for API description
-int dblog_bin_srch_row_by_val(struct dblog_read_context *rctx, int col_idx,
-      int val_type, void *val, uint16_t len, byte is_rowid) {
+// Returns days since 1970-01-01 of given date in proleptic Gregorian calendar
+int32_t days_from_civil(int32_t y, int32_t m, int32_t d) {
+  y -= m <= 2;
+  int32_t era = (y >= 0 ? y : y - 399) / 400;
+  int32_t yoe = y - era * 400;
+  int32_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  int32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+// Reads given no. of digits as a number, returning -1 if not all digits
+int32_t read_digits(const byte *ptr, int count) {
+  int32_t num = 0;
+  while (count--) {
+    if (*ptr < '0' || *ptr > '9')
+      return -1;
+    num = num * 10 + (*ptr++ - '0');
+  }
+  return num;
+}
+
+// Converts ISO-8601 timestamp such as YYYY-MM-DD HH:MM:SS.SSS or
+// YYYY-MM-DDTHH:MM:SS or YYYY-MM-DD to seconds since epoch
+// Returns 0 if not in this format
+byte iso8601_to_secs(const byte *ts, uint16_t len, double *out) {
+  if (len < 10 || ts[4] != '-' || ts[7] != '-')
+    return 0;
+  int32_t y = read_digits(ts, 4);
+  int32_t m = read_digits(ts + 5, 2);
+  int32_t d = read_digits(ts + 8, 2);
+  if (y < 0 || m < 1 || m > 12 || d < 1 || d > 31)
+    return 0;
+  *out = (double) days_from_civil(y, m, d) * 86400;
+  if (len < 19)
+    return 1;
+  if ((ts[10] != ' ' && ts[10] != 'T') || ts[13] != ':' || ts[16] != ':')
+    return 0;
+  int32_t hh = read_digits(ts + 11, 2);
+  int32_t mm = read_digits(ts + 14, 2);
+  int32_t ss = read_digits(ts + 17, 2);
+  if (hh < 0 || mm < 0 || ss < 0)
+    return 0;
+  *out += hh * 3600 + mm * 60 + ss;
+  if (len > 20 && ts[19] == '.') {
+    double scale = 0.1;
+    for (uint16_t i = 20; i < len && ts[i] >= '0' && ts[i] <= '9'; i++) {
+      *out += (ts[i] - '0') * scale;
+      scale /= 10;
+    }
+  }
+  return 1;
+}
+
+// Converts value given for search to a number for interpolation
+// Returns 0 if not possible
+byte num_of_val(int val_type, const void *val, uint16_t len, double *out) {
+  switch (val_type) {
+    case DBLOG_TYPE_INT:
+      *out = (double) convert_to_i64((byte *) val, len, 0);
+      return 1;
+    case DBLOG_TYPE_REAL:
+      if (len == 4)
+        *out = *((float *) val);
+      else
+        *out = *((double *) val);
+      return 1;
+    case DBLOG_TYPE_TEXT:
+      return iso8601_to_secs((const byte *) val, len, out);
+  }
+  return 0;
+}
+
+// Converts value read from the database to a number for interpolation
+// Returns 0 if not possible
+byte num_of_val_at(int val_type, const byte *val_at, uint32_t col_type, double *out) {
+  switch (val_type) {
+    case DBLOG_TYPE_INT:
+      if (col_type < 1 || col_type > 6)
+        return 0;
+      *out = (double) convert_to_i64((byte *) val_at, dblog_derive_data_len(col_type), 1);
+      return 1;
+    case DBLOG_TYPE_REAL: {
+      if (col_type != 7)
+        return 0;
+      uint64_t bytes64 = read_uint64((byte *) val_at);
+      memcpy(out, &bytes64, 8);
+      return 1;
+    }
+    case DBLOG_TYPE_TEXT:
+      return col_type >= 13 && (col_type % 2) &&
+        iso8601_to_secs(val_at, dblog_derive_data_len(col_type), out);
+  }
+  return 0;
+}
+
+// Finds n-th leaf page that could have given value using key directory
+// written by finalize (see write_key_dir()) reading a page of each level
+int srch_key_dir(struct dblog_read_context *rctx, int val_type, void *val,
+      uint16_t len, uint32_t leaf_count, int32_t page_size, uint32_t *out_leaf_no) {
+  byte entry_len = rctx->key_dir_entry_len;
+  uint16_t per_page = (page_size - KEY_DIR_HDR_LEN) / entry_len;
+  uint32_t level_pages[32];
+  uint32_t level_count[32];
+  byte level = 0;
+  level_count[0] = leaf_count;
+  level_pages[0] = (leaf_count + per_page - 1) / per_page;
+  while (level_pages[level] > 1 && level < 31) {
+    level_count[level + 1] = level_pages[level];
+    level_pages[level + 1] = (level_pages[level] + per_page - 1) / per_page;
+    level++;
+  }
+  uint32_t level_page = rctx->key_dir_page;
+  for (byte i = 0; i < level; i++)
+    level_page += level_pages[i];
+  uint32_t idx = 0; // page within level
+  while (1) {
+    int res = read_page_rctx(rctx, level_page + idx, page_size);
+    if (res)
+      return res;
+    uint32_t first = 0;
+    uint32_t size = level_count[level] - idx * per_page;
+    if (size > per_page)
+      size = per_page;
+    uint32_t last = size - 1;
+    while (first < size) {
+      uint32_t middle = (first + size) >> 1;
+      byte *entry = rctx->buf + KEY_DIR_HDR_LEN + middle * entry_len;
+      int cmp = compare_values(entry + 2, read_uint16(entry), val_type, val, len, 0);
+      if (cmp == DBLOG_RES_TYPE_MISMATCH)
+        return cmp;
+      if (cmp < 0)
+        first = middle + 1;
+      else
+        size = middle;
+    }
+    if (first > last)
+      first = last; // greater than all values
+    idx = idx * per_page + first;
+    if (level == 0)
+      break;
+    level--;
+    level_page -= level_pages[level];
+  }
+  *out_leaf_no = idx + 1;
+  return DBLOG_RES_OK;
+}
+
+#if DBLOG_CFG_FENCE_CACHE
+// Remembers last value of leaf page found during search in fence
+// cache, in the place of the least recently used one if full
+void add_fence(struct dblog_read_context *rctx, int col_idx, uint32_t leaf_no,
+      uint32_t page_no, byte *val_at, uint32_t col_type, uint16_t rec_pos) {
+  if (!rctx->fence_cache_len || (col_idx >= 0
+        && dblog_derive_data_len(col_type) > DBLOG_FENCE_VAL_LEN))
+    return;
+  struct dblog_fence *fences = rctx->fence_cache;
+  byte used = rctx->fence_cache_used;
+  byte i;
+  for (i = 0; i < used; i++) {
+    if (fences[i].col_idx == col_idx && fences[i].leaf_no == leaf_no) {
+      fences[i].last_used = ++rctx->cache_tick;
+      return;
+    }
+  }
+  if (used == rctx->fence_cache_len) {
+    byte victim = 0;
+    for (i = 1; i < used; i++) {
+      if ((int32_t) (fences[i].last_used - fences[victim].last_used) < 0)
+        victim = i;
+    }
+    memmove(fences + victim, fences + victim + 1, (used - victim - 1) * sizeof(struct dblog_fence));
+    used--;
+  }
+  for (i = used; i > 0 && (fences[i - 1].col_idx > col_idx
+        || (fences[i - 1].col_idx == col_idx && fences[i - 1].leaf_no > leaf_no)); i--)
+    fences[i] = fences[i - 1];
+  fences[i].leaf_no = leaf_no;
+  fences[i].page_no = page_no;
+  fences[i].last_used = ++rctx->cache_tick;
+  fences[i].col_type = col_type;
+  fences[i].rec_pos = rec_pos;
+  fences[i].col_idx = col_idx;
+  if (col_idx >= 0)
+    memcpy(fences[i].val, val_at, dblog_derive_data_len(col_type));
+  rctx->fence_cache_used = used + 1;
+}
+#endif
+
+// Steps of interpolation search
+// Searches for given value, bisecting the leaf pages or, if interp = 1,
+// probing where the value is estimated to be by linear interpolation
+// between last values of leaf pages found before and after it.
+// If the same side moves twice in a row, distance of value on the
+// other side is halved (Illinois method) so that the estimates do not
+// creep towards the value from one side. If two estimates did not
+// halve the range, bisects once before estimating again.
+// Values that cannot be converted to numbers are only bisected
+int srch_row_by_val(struct dblog_read_context *rctx, int col_idx,
+      int val_type, void *val, uint16_t len, byte is_rowid, byte interp) {
   int32_t page_size = get_pagesize(rctx->page_size_exp);
   if (rctx->last_leaf_page == 0)
     return DBLOG_RES_NOT_FINALIZED;
   uint32_t middle, first, size;
   int res;
+  uint32_t leaf_count = leaf_page_count(rctx);
   first = 1;
-  size = rctx->last_leaf_page + 1;
+  size = leaf_count + 1;
+  double val_num = 0, lo_num = 0, hi_num = 0;
+  if (is_rowid)
+    val_num = *((uint32_t *) val);
+  else if (interp)
+    interp = num_of_val(val_type, val, len, &val_num);
+  byte fences = 0; // 1 if lo_num known, 2 if hi_num known
+  if (!is_rowid && rctx->key_dir_col == col_idx + 1 && rctx->key_dir_entry_len) {
+    res = srch_key_dir(rctx, val_type, val, len, leaf_count, page_size, &first);
+    if (res)
+      return res;
+    size = first;
+  }
+#if DBLOG_CFG_FENCE_CACHE
+  // narrow the range using last values found in earlier searches
+  int fence_col = (is_rowid ? -1 : col_idx);
+  for (byte i = 0; i < rctx->fence_cache_used; i++) {
+    struct dblog_fence *fence = rctx->fence_cache + i;
+    if (fence->col_idx != fence_col || fence->leaf_no < first || fence->leaf_no >= size)
+      continue;
+    int cmp = compare_values(fence->val, fence->col_type, val_type, val, len, is_rowid);
+    if (cmp == DBLOG_RES_TYPE_MISMATCH)
+      continue;
+    fence->last_used = ++rctx->cache_tick;
+    double num_at = fence->col_type;
+    if (interp && !is_rowid)
+      interp = num_of_val_at(val_type, fence->val, fence->col_type, &num_at);
+    if (cmp < 0) {
+      first = fence->leaf_no + 1;
+      lo_num = num_at;
+      fences |= 1;
+    } else if (cmp > 0) {
+      size = fence->leaf_no;
+      hi_num = num_at;
+      fences |= 2;
+    } else {
+      rctx->cur_page = fence->page_no;
+      rctx->cur_rec_pos = fence->rec_pos;
+      return read_page_rctx(rctx, fence->page_no, page_size);
+    }
+  }
+#endif
+  byte last_side = 0; // fence moved by previous probe
+  byte estimates = 0; // no. of estimates since range was last checked
+  uint32_t width = 0; // range when last checked
   while (first < size) {
-    middle = (first + size) >> 1;
+    if (!interp)
+      middle = (first + size) >> 1;
+    else if (!(fences & 2))
+      middle = size - 1;
+    else if (!(fences & 1))
+      middle = first;
+    else if (hi_num <= lo_num || (estimates == 2 && size - first > width / 2)) {
+      middle = (first + size) >> 1;
+      estimates = 0;
+    } else {
+      if (estimates == 2)
+        estimates = 0;
+      if (estimates++ == 0)
+        width = size - first;
+      double est = (first - 1) + (val_num - lo_num) / (hi_num - lo_num) * (size - first + 1);
+      middle = size - 1;
+      if (!(est > first))
+        middle = first;
+      else if (est < middle) {
+        middle = (uint32_t) est;
+        if (middle < est)
+          middle++;
+      }
+    }
     uint16_t rec_pos;
-    byte val_at[len + 1];
+    int val_len = (len < DBLOG_FENCE_VAL_LEN ? DBLOG_FENCE_VAL_LEN : len + 1);
+    byte val_at[val_len];
     uint32_t u32_at;
-    res = read_last_val(rctx, middle, page_size, col_idx, 
-            val_at, len + 1, &u32_at, &rec_pos, is_rowid);
+    uint32_t leaf_page = leaf_page_at(rctx, middle);
+    res = read_last_val(rctx, &leaf_page, has_tables_rctx(rctx) ? first : 1, page_size,
+            col_idx, val_at, val_len, &u32_at, &rec_pos, is_rowid);
+    if (res == DBLOG_RES_NOT_FOUND) {
+      first = middle + 1; // no leaf page of the table from first to middle
+      continue;
+    }
     if (res)
       return res;
     int cmp = compare_values(val_at, u32_at, val_type, val, len, is_rowid);
     if (cmp == DBLOG_RES_TYPE_MISMATCH)
       return cmp;
-    if (cmp < 0)
+#if DBLOG_CFG_FENCE_CACHE
+    add_fence(rctx, fence_col, middle, leaf_page, val_at, u32_at, rec_pos);
+#endif
+    double num_at = u32_at;
+    if (interp && !is_rowid)
+      interp = num_of_val_at(val_type, val_at, u32_at, &num_at);
+    if (cmp < 0) {
       first = middle + 1;
-    else if (cmp > 0)
+      lo_num = num_at;
+      if (last_side == 1)
+        hi_num = val_num + (hi_num - val_num) / 2;
+      last_side = 1;
+      fences |= 1;
+    } else if (cmp > 0) {
       size = middle;
-    else {
-      rctx->cur_page = middle;
+      hi_num = num_at;
+      if (last_side == 2)
+        lo_num = val_num - (val_num - lo_num) / 2;
+      last_side = 2;
+      fences |= 2;
+    } else {
+      rctx->cur_page = leaf_page;
       rctx->cur_rec_pos = rec_pos;
-      res = read_bytes_rctx(rctx, rctx->buf, middle * page_size, page_size);
+      res = read_page_rctx(rctx, leaf_page, page_size);
       if (res)
         return res;
       return DBLOG_RES_OK;
     }
   }
-  if (size == rctx->last_leaf_page + 1)
+  if (size == leaf_count + 1)
     size--;
-  uint32_t found_at_page = size;
-  res = read_bytes_rctx(rctx, rctx->buf, size * page_size, page_size);
+  rctx->cur_page = leaf_page_at(rctx, size);
+  res = read_cur_leaf_page(rctx, -1);
   if (res)
     return res;
+  uint32_t found_at_page = rctx->cur_page;
   first = 0;
   int16_t rec_count = read_uint16(rctx->buf + 3) - 1;
   size = rec_count;
@@ -1495,9 +5047,605 @@ int dblog_bin_srch_row_by_val(struct dblog_read_context *rctx, int col_idx,
   return DBLOG_RES_OK;
 }
 
+// See .h file for API description
+int dblog_bin_srch_row_by_val(struct dblog_read_context *rctx, int col_idx,
+      int val_type, void *val, uint16_t len, byte is_rowid) {
+  return srch_row_by_val(rctx, col_idx, val_type, val, len, is_rowid, 0);
+}
+
+// See .h file for API description
+int dblog_interp_srch_row_by_val(struct dblog_read_context *rctx, int col_idx,
+      int val_type, void *val, uint16_t len, byte is_rowid) {
+  return srch_row_by_val(rctx, col_idx, val_type, val, len, is_rowid, 1);
+}
+
+// Compares value of given column (or Row ID) at current position
+// with given value and returns result in cmp
+int cmp_cur_val(struct dblog_read_context *rctx, int col_idx, int val_type,
+      void *val, uint16_t len, byte is_rowid, int *cmp) {
+  uint32_t u32_at;
+  byte *val_at = read_val_at(rctx, rctx->cur_rec_pos, col_idx, &u32_at, is_rowid);
+  if (!val_at)
+    return DBLOG_RES_NOT_FOUND;
+  *cmp = compare_values(val_at, u32_at, val_type, val, len, is_rowid);
+  if (*cmp == DBLOG_RES_TYPE_MISMATCH)
+    return *cmp;
+  return DBLOG_RES_OK;
+}
+
+// Parses given zone map entry (see write_zones()) into out_zone
+void parse_zone(byte *entry, struct dblog_summary *out_zone) {
+  out_zone->count = read_uint16(entry + 2);
+  out_zone->is_real = entry[1];
+  if (out_zone->is_real) {
+    uint64_t bytes64 = read_uint64(entry + 4);
+    memcpy(&out_zone->min, &bytes64, 8);
+    bytes64 = read_uint64(entry + 12);
+    memcpy(&out_zone->max, &bytes64, 8);
+    bytes64 = read_uint64(entry + 20);
+    memcpy(&out_zone->sum, &bytes64, 8);
+    out_zone->min_int = out_zone->max_int = out_zone->sum_int = 0;
+  } else {
+    out_zone->min_int = (int64_t) read_uint64(entry + 4);
+    out_zone->max_int = (int64_t) read_uint64(entry + 12);
+    out_zone->sum_int = (int64_t) read_uint64(entry + 20);
+    out_zone->min = (double) out_zone->min_int;
+    out_zone->max = (double) out_zone->max_int;
+    out_zone->sum = (double) out_zone->sum_int;
+  }
+}
+
+// Reads zone map of given column of given page, reading only the
+// page header and zone maps and not the whole page
+// Returns DBLOG_RES_NOT_FOUND if the page is not a leaf page or
+// its zone maps were not formed. If there is more than one table,
+// pages not having rows of the table being read give empty zone
+int read_zone(struct dblog_read_context *rctx, uint32_t page_no, int col_idx,
+      struct dblog_summary *out_zone, int32_t page_size) {
+  if (!rctx->zone_col_count)
+    return DBLOG_RES_NOT_FOUND;
+  byte zone[ZONE_HDR_LEN + ZONE_LEN];
+  long zone_pos = (long) (page_no + 1) * page_size
+                     - zone_area_len(rctx->zone_col_count);
+  int res = read_bytes_rctx(rctx, zone, (long) page_no * page_size, 5);
+  if (res)
+    return res;
+  if (has_tables_rctx(rctx) && !is_table_leaf(rctx, zone, page_no, page_size)) {
+    memset(out_zone, '\0', sizeof(struct dblog_summary));
+    return DBLOG_RES_OK;
+  }
+  uint16_t rec_count = read_uint16(zone + 3);
+  if (zone[0] != 13 || rec_count == 0)
+    return DBLOG_RES_NOT_FOUND;
+  // row count is read along with first entry
+  res = read_bytes_rctx(rctx, zone, zone_pos, ZONE_HDR_LEN + ZONE_LEN);
+  if (res)
+    return res;
+  if (read_uint16(zone) != rec_count)
+    return DBLOG_RES_NOT_FOUND;
+  byte *entry = zone + ZONE_HDR_LEN;
+  zone_pos += ZONE_HDR_LEN;
+  for (byte i = 0; i < rctx->zone_col_count; i++) {
+    if (i) {
+      res = read_bytes_rctx(rctx, entry, zone_pos, ZONE_LEN);
+      if (res)
+        return res;
+    }
+    if (entry[0] == col_idx) {
+      parse_zone(entry, out_zone);
+      return DBLOG_RES_OK;
+    }
+    zone_pos += ZONE_LEN;
+  }
+  return DBLOG_RES_NOT_FOUND;
+}
+
+// See .h file for API description
+int dblog_read_zone(struct dblog_read_context *rctx, int col_idx,
+      struct dblog_summary *out_zone) {
+  int32_t page_size = get_pagesize(rctx->page_size_exp);
+  uint16_t rec_count = read_uint16(rctx->buf + 3);
+  byte *zone = rctx->buf + page_size - zone_area_len(rctx->zone_col_count);
+  if (!rctx->zone_col_count || rctx->buf[0] != 13 || rec_count == 0
+        || read_uint16(zone) != rec_count)
+    return DBLOG_RES_NOT_FOUND;
+  zone += ZONE_HDR_LEN;
+  for (byte i = 0; i < rctx->zone_col_count; i++) {
+    if (zone[0] == col_idx) {
+      parse_zone(zone, out_zone);
+      return DBLOG_RES_OK;
+    }
+    zone += ZONE_LEN;
+  }
+  return DBLOG_RES_NOT_FOUND;
+}
+
+// Returns 1 if zone map of given column of given page shows
+// none of its rows have a number between flo and fhi
+byte zone_excludes(struct dblog_read_context *rctx, uint32_t page_no,
+      int col_idx, double flo, double fhi, int32_t page_size) {
+  struct dblog_summary zone;
+  if (read_zone(rctx, page_no, col_idx, &zone, page_size))
+    return 0;
+  return zone.count == 0 || zone.max < flo || zone.min > fhi;
+}
+
+// Returns 1 if value of given column at current position
+// is a number between flo and fhi
+byte cur_val_within(struct dblog_read_context *rctx, int col_idx,
+      double flo, double fhi) {
+  uint32_t col_type;
+  const byte *val_at = (const byte *) dblog_read_col_val(rctx, col_idx, &col_type);
+  double dval;
+  return val_at && num_of_rec_val(val_at, col_type, &dval)
+           && dval >= flo && dval <= fhi;
+}
+
+// Moves to next row like dblog_read_next_row(), but past leaf pages
+// before end_page whose zone map of filter_col shows none of their
+// rows have a number between flo and fhi
+int read_next_row_where(struct dblog_read_context *rctx, uint32_t end_page,
+      int filter_col, double flo, double fhi) {
+  if (end_page && rctx->cur_rec_pos + 1 == read_uint16(rctx->buf + 3)) {
+    int32_t page_size = get_pagesize(rctx->page_size_exp);
+    while (rctx->cur_page != end_page && rctx->cur_page != rctx->last_leaf_page) {
+      uint32_t next_page = next_leaf_page(rctx->cur_page, rctx->max_pages_exp);
+      if (next_page == end_page
+            || !zone_excludes(rctx, next_page, filter_col, flo, fhi, page_size))
+        break;
+      rctx->cur_page = next_page; // buf still has the last page read
+    }
+  }
+  return dblog_read_next_row(rctx);
+}
+
+// Positions at first record having value of given column (or Row ID)
+// not less than lo. Sets out_past_end if there is no such record
+int seek_range(struct dblog_read_context *rctx, int col_idx, int val_type,
+      void *lo, uint16_t lo_len, byte is_rowid, byte *out_past_end) {
+  *out_past_end = 0;
+  int res = dblog_bin_srch_row_by_val(rctx, col_idx, val_type, lo, lo_len, is_rowid);
+  if (res)
+    return res;
+  // closest match found may be after or in between rows equal to lo
+  int cmp;
+  do {
+    res = cmp_cur_val(rctx, col_idx, val_type, lo, lo_len, is_rowid, &cmp);
+    if (res)
+      return res;
+  } while (cmp >= 0 && dblog_read_prev_row(rctx) == DBLOG_RES_OK);
+  while (cmp < 0) {
+    if (dblog_read_next_row(rctx)) {
+      *out_past_end = 1;
+      return DBLOG_RES_OK;
+    }
+    res = cmp_cur_val(rctx, col_idx, val_type, lo, lo_len, is_rowid, &cmp);
+    if (res)
+      return res;
+  }
+  return DBLOG_RES_OK;
+}
+
+// Calls row_fn for rows in given range as in dblog_scan_range()
+// If filter_col is not -1, only for rows having a number between
+// flo and fhi in it, skipping pages using zone maps if available
+int scan_range(struct dblog_read_context *rctx, int col_idx, int val_type,
+      void *lo, uint16_t lo_len, void *hi, uint16_t hi_len, byte is_rowid,
+      int filter_col, double flo, double fhi,
+      int (*row_fn)(struct dblog_read_context *ctx)) {
+  int res;
+  uint32_t end_page = 0; // pages before the one having hi can be skipped
+  if (filter_col >= 0 && rctx->zone_col_count) {
+    res = dblog_bin_srch_row_by_val(rctx, col_idx, val_type, hi, hi_len, is_rowid);
+    if (res)
+      return res;
+    end_page = rctx->cur_page;
+  }
+  byte past_end;
+  res = seek_range(rctx, col_idx, val_type, lo, lo_len, is_rowid, &past_end);
+  if (res || past_end)
+    return res;
+  int cmp;
+  do {
+    res = cmp_cur_val(rctx, col_idx, val_type, hi, hi_len, is_rowid, &cmp);
+    if (res)
+      return res;
+    if (cmp > 0)
+      break;
+    if (filter_col < 0 || cur_val_within(rctx, filter_col, flo, fhi)) {
+      res = row_fn(rctx);
+      if (res)
+        return res;
+    }
+  } while (read_next_row_where(rctx, end_page, filter_col, flo, fhi) == DBLOG_RES_OK);
+  return DBLOG_RES_OK;
+}
+
+// See .h file for API description
+int dblog_scan_range(struct dblog_read_context *rctx, int col_idx, int val_type,
+      void *lo, uint16_t lo_len, void *hi, uint16_t hi_len, byte is_rowid,
+      int (*row_fn)(struct dblog_read_context *ctx)) {
+  return scan_range(rctx, col_idx, val_type, lo, lo_len, hi, hi_len, is_rowid,
+           -1, 0, 0, row_fn);
+}
+
+// See .h file for API description
+int dblog_scan_range_where(struct dblog_read_context *rctx, int col_idx,
+      int val_type, void *lo, uint16_t lo_len, void *hi, uint16_t hi_len,
+      byte is_rowid, int filter_col, double flo, double fhi,
+      int (*row_fn)(struct dblog_read_context *ctx)) {
+  return scan_range(rctx, col_idx, val_type, lo, lo_len, hi, hi_len, is_rowid,
+           filter_col, flo, fhi, row_fn);
+}
+
+// Adds given summary (of a zone map) to another
+void merge_summary(struct dblog_summary *sum, struct dblog_summary *part) {
+  if (!part->count)
+    return;
+  if (part->is_real)
+    sum->is_real = 1;
+  else {
+    if (!sum->count || part->min_int < sum->min_int)
+      sum->min_int = part->min_int;
+    if (!sum->count || part->max_int > sum->max_int)
+      sum->max_int = part->max_int;
+    sum->sum_int = (int64_t) ((uint64_t) sum->sum_int + (uint64_t) part->sum_int);
+  }
+  if (!sum->count || part->min < sum->min)
+    sum->min = part->min;
+  if (!sum->count || part->max > sum->max)
+    sum->max = part->max;
+  sum->sum += part->sum;
+  sum->count += part->count;
+}
+
+// Converts INT, REAL or ISO-8601 timestamp value read from a record
+// to a number (seconds for timestamps). Returns 0 if not possible
+byte key_num_of_rec_val(const byte *val_at, uint32_t col_type, double *out) {
+  if (col_type >= 13 && col_type % 2)
+    return iso8601_to_secs(val_at, dblog_derive_data_len(col_type), out);
+  return num_of_rec_val(val_at, col_type, out);
+}
+
+// Returns number of key of record at given position of current page
+// in out_key, or 0 if it is not a number
+byte key_num_at(struct dblog_read_context *rctx, uint16_t pos, int key_col,
+      byte is_rowid, double *out_key) {
+  uint32_t col_type;
+  byte *val_at = read_val_at(rctx, pos, key_col, &col_type, is_rowid);
+  if (val_at == NULL)
+    return 0;
+  if (is_rowid) {
+    *out_key = col_type;
+    return 1;
+  }
+  return key_num_of_rec_val(val_at, col_type, out_key);
+}
+
+// Returns start of bucket of given width having given key
+double bucket_of(double key, double bucket_width) {
+  double quot = key / bucket_width;
+  int64_t n = (int64_t) quot;
+  if (n > quot)
+    n--;
+  return n * bucket_width;
+}
+
+// Calls bucket_fn with summary of current bucket if given key
+// is in another bucket and starts summary of that bucket
+int switch_bucket(struct dblog_read_context *rctx, double key, double bucket_width,
+      int (*bucket_fn)(struct dblog_read_context *ctx, double bucket,
+                       struct dblog_summary *sum),
+      double *bucket, struct dblog_summary *sum) {
+  double key_bucket = bucket_of(key, bucket_width);
+  if (sum->count && key_bucket != *bucket) {
+    int res = bucket_fn(rctx, *bucket, sum);
+    if (res)
+      return res;
+    memset(sum, '\0', sizeof(struct dblog_summary));
+  }
+  *bucket = key_bucket;
+  return DBLOG_RES_OK;
+}
+
+// Summarizes values of col_idx in records whose key_col value (or Row ID)
+// is between lo and hi (NULL for no limit) into out_sum, or if bucket_fn
+// is given, into buckets of key_col values passed to bucket_fn
+// Rows before the page having hi need not be compared with it. Pages
+// entirely in range are summarized from their zone maps, if formed,
+// without being read and without decoding rows if read for buckets
+int summarize_range(struct dblog_read_context *rctx, int key_col, int val_type,
+      void *lo, uint16_t lo_len, void *hi, uint16_t hi_len, byte is_rowid,
+      int col_idx, double bucket_width,
+      int (*bucket_fn)(struct dblog_read_context *ctx, double bucket,
+                       struct dblog_summary *sum),
+      struct dblog_summary *out_sum) {
+  int32_t page_size = get_pagesize(rctx->page_size_exp);
+  struct dblog_summary sum;
+  memset(&sum, '\0', sizeof(sum));
+  double bucket = 0;
+  int res;
+  uint32_t end_page = 0;
+  if (hi) {
+    res = dblog_bin_srch_row_by_val(rctx, key_col, val_type, hi, hi_len, is_rowid);
+    if (res)
+      return res;
+    end_page = rctx->cur_page;
+  }
+  byte past_end = 0;
+  if (lo) {
+    res = seek_range(rctx, key_col, val_type, lo, lo_len, is_rowid, &past_end);
+    if (res)
+      return res;
+  } else if (dblog_read_first_row(rctx) || read_uint16(rctx->buf + 3) == 0)
+    past_end = 1;
+  byte first_page = 1;
+  byte reached_end = 0;
+  while (!past_end) {
+    uint16_t rec_count = read_uint16(rctx->buf + 3);
+    if (rctx->cur_page == end_page)
+      reached_end = 1;
+    byte check_hi = hi && (first_page || reached_end);
+    struct dblog_summary zone;
+    double first_key, last_key;
+    if (!check_hi && rctx->cur_rec_pos == 0
+          && dblog_read_zone(rctx, col_idx, &zone) == DBLOG_RES_OK
+          && (!bucket_fn || (key_num_at(rctx, 0, key_col, is_rowid, &first_key)
+                && key_num_at(rctx, rec_count - 1, key_col, is_rowid, &last_key)
+                && bucket_of(first_key, bucket_width) == bucket_of(last_key, bucket_width)))) {
+      if (bucket_fn) {
+        res = switch_bucket(rctx, first_key, bucket_width, bucket_fn, &bucket, &sum);
+        if (res)
+          return res;
+      }
+      merge_summary(&sum, &zone);
+    } else {
+      for (; rctx->cur_rec_pos < rec_count; rctx->cur_rec_pos++) {
+        if (check_hi) {
+          int cmp;
+          res = cmp_cur_val(rctx, key_col, val_type, hi, hi_len, is_rowid, &cmp);
+          if (res)
+            return res;
+          if (cmp > 0) {
+            past_end = 1;
+            break;
+          }
+        }
+        if (bucket_fn) {
+          double key;
+          if (!key_num_at(rctx, rctx->cur_rec_pos, key_col, is_rowid, &key))
+            continue;
+          res = switch_bucket(rctx, key, bucket_width, bucket_fn, &bucket, &sum);
+          if (res)
+            return res;
+        }
+        uint32_t col_type;
+        byte *val_at = read_val_at(rctx, rctx->cur_rec_pos, col_idx, &col_type, 0);
+        if (val_at)
+          add_to_summary(&sum, val_at, col_type);
+      }
+      if (past_end)
+        break;
+    }
+    first_page = 0;
+    // following pages before the one having hi are summarized
+    // from zone maps, reading only the zone maps
+    while (!bucket_fn && !reached_end && rctx->cur_page != rctx->last_leaf_page) {
+      uint32_t next_page = next_leaf_page(rctx->cur_page, rctx->max_pages_exp);
+      if ((hi && next_page == end_page)
+            || read_zone(rctx, next_page, col_idx, &zone, page_size))
+        break;
+      merge_summary(&sum, &zone);
+      rctx->cur_page = next_page; // buf still has the last page read
+    }
+    rctx->cur_rec_pos = rec_count - 1;
+    if (dblog_read_next_row(rctx))
+      break;
+  }
+  if (bucket_fn)
+    return sum.count ? bucket_fn(rctx, bucket, &sum) : DBLOG_RES_OK;
+  memcpy(out_sum, &sum, sizeof(sum));
+  return DBLOG_RES_OK;
+}
+
+// See .h file for API description
+int dblog_aggregate(struct dblog_read_context *rctx, int key_col, int val_type,
+      void *lo, uint16_t lo_len, void *hi, uint16_t hi_len, byte is_rowid,
+      int col_idx, struct dblog_summary *out_sum) {
+  return summarize_range(rctx, key_col, val_type, lo, lo_len, hi, hi_len,
+           is_rowid, col_idx, 0, NULL, out_sum);
+}
+
+// See .h file for API description
+int dblog_bucketize(struct dblog_read_context *rctx, int key_col, int val_type,
+      void *lo, uint16_t lo_len, void *hi, uint16_t hi_len, int col_idx,
+      double bucket_width, int (*bucket_fn)(struct dblog_read_context *ctx,
+                             double bucket, struct dblog_summary *sum)) {
+  if (bucket_width <= 0)
+    return DBLOG_RES_ERR;
+  return summarize_range(rctx, key_col, val_type, lo, lo_len, hi, hi_len,
+           0, col_idx, bucket_width, bucket_fn, NULL);
+}
+
+#if DBLOG_CFG_PARALLEL_SCAN
+
+// Range of leaf pages scanned by a thread of dblog_scan_partitions()
+struct scan_part {
+  struct dblog_read_context *rctx;
+  uint32_t first;       // Position of first leaf page (starting with 1)
+  uint32_t count;       // No. of leaf pages
+  int (*row_fn)(struct dblog_read_context *ctx);
+  int res;
+};
+
+// Calls row_fn for rows of leaf pages of a range, passing over
+// interior pages and leaf pages of other tables as in read_cur_leaf_page()
+void *scan_part_rows(void *arg) {
+  struct scan_part *part = (struct scan_part *) arg;
+  struct dblog_read_context *rctx = part->rctx;
+  part->res = DBLOG_RES_OK;
+  for (uint32_t n = part->first; n < part->first + part->count; n++) {
+    rctx->cur_page = leaf_page_at(rctx, n);
+    int res = read_cur_page(rctx);
+    if (res == DBLOG_RES_NOT_FOUND)
+      continue;
+    if (res) {
+      part->res = res;
+      break;
+    }
+    uint16_t rec_count = read_uint16(rctx->buf + 3);
+    for (rctx->cur_rec_pos = 0; rctx->cur_rec_pos < rec_count; rctx->cur_rec_pos++) {
+      res = part->row_fn(rctx);
+      if (res) {
+        part->res = res;
+        return NULL;
+      }
+    }
+  }
+  return NULL;
+}
+
+// See .h file for API description
+int dblog_scan_partitions(struct dblog_read_context *rctxs, byte part_count,
+      int (*row_fn)(struct dblog_read_context *ctx),
+      int (*reduce_fn)(struct dblog_read_context *ctx, byte part)) {
+  if (part_count == 0)
+    return DBLOG_RES_ERR;
+  for (byte i = 0; i < part_count; i++) {
+    int res = dblog_read_init(rctxs + i);
+    if (res)
+      return res;
+  }
+  if (rctxs->last_leaf_page == 0)
+    return DBLOG_RES_NOT_FINALIZED;
+  uint32_t count = leaf_page_count(rctxs);
+  uint32_t part_len = (count + part_count - 1) / part_count;
+  struct scan_part parts[part_count];
+  pthread_t threads[part_count];
+  byte started[part_count];
+  for (byte i = 0; i < part_count; i++) {
+    uint32_t from = i * part_len;
+    parts[i].rctx = rctxs + i;
+    parts[i].first = from + 1;
+    parts[i].count = (from >= count ? 0 : (count - from < part_len ? count - from : part_len));
+    parts[i].row_fn = row_fn;
+    parts[i].res = DBLOG_RES_OK;
+    // the calling thread takes the first range and any range
+    // for which a thread cannot be created
+    started[i] = (i && parts[i].count
+                    && pthread_create(&threads[i], NULL, scan_part_rows, parts + i) == 0);
+  }
+  for (byte i = 0; i < part_count; i++) {
+    if (!started[i] && parts[i].count)
+      scan_part_rows(parts + i);
+  }
+  for (byte i = 1; i < part_count; i++) {
+    if (started[i])
+      pthread_join(threads[i], NULL);
+  }
+  for (byte i = 0; i < part_count; i++) {
+    if (parts[i].res)
+      return parts[i].res;
+    if (reduce_fn) {
+      int res = reduce_fn(rctxs + i, i);
+      if (res)
+        return res;
+    }
+  }
+  return DBLOG_RES_OK;
+}
+
+#endif
+
+// Reads root page of index, if any, from schema table in first page
+// Set to DBLOG_NO_PAGE if there is no index
+int read_index_root(struct dblog_read_context *rctx, int32_t page_size) {
+  if (rctx->index_root)
+    return DBLOG_RES_OK;
+  int res = read_page_rctx(rctx, 0, page_size);
+  if (res)
+    return res;
+  rctx->index_root = DBLOG_NO_PAGE;
+  uint16_t rec_count = read_uint16(rctx->buf + 103);
+  for (uint16_t i = 1; i < rec_count; i++) {
+    uint16_t rec_pos = read_uint16(rctx->buf + 108 + i * 2);
+    uint16_t limit = page_size - rctx->page_resv_bytes - rec_pos;
+    uint32_t col_type;
+    const byte *type = (const byte *) get_col_val(rctx->buf, rec_pos, 0, &col_type, limit);
+    if (type && col_type == 5 * 2 + 13 && memcmp(type, "index", 5) == 0) {
+      const byte *root = (const byte *) get_col_val(rctx->buf, rec_pos, 3, &col_type, limit);
+      if (root && col_type == 4)
+        rctx->index_root = read_uint32((byte *) root);
+      break;
+    }
+  }
+  return DBLOG_RES_OK;
+}
+
+// See .h file for API description
+int dblog_srch_by_index(struct dblog_read_context *rctx, int val_type,
+      void *val, uint16_t len, uint32_t min_rowid) {
+  int32_t page_size = get_pagesize(rctx->page_size_exp);
+  int res = read_index_root(rctx, page_size);
+  if (res)
+    return res;
+  if (rctx->index_root == DBLOG_NO_PAGE)
+    return DBLOG_RES_NOT_FOUND;
+  // value is compared in the form it is stored
+  uint32_t col_type = derive_col_type_or_len(val_type, val, len);
+  byte val_data[len > 8 ? len : 8];
+  write_data(val_data, val_type, val, len);
+  // least entry not less than (value, min_rowid) is either
+  // in a leaf page or a separator in an interior page above it
+  byte found = 0;
+  uint32_t found_rowid = 0;
+  uint32_t page_no = rctx->index_root;
+  byte is_leaf;
+  do {
+    res = read_page_rctx(rctx, page_no - 1, page_size);
+    if (res)
+      return res;
+    if (*rctx->buf != 10 && *rctx->buf != 2)
+      return DBLOG_RES_MALFORMED;
+    is_leaf = (*rctx->buf == 10);
+    uint16_t ptr_pos = (is_leaf ? 8 : 12);
+    uint32_t count = read_uint16(rctx->buf + 3);
+    uint32_t middle, first, size;
+    first = 0;
+    size = count;
+    uint32_t type_at, rowid_at;
+    const byte *val_at;
+    while (first < size) {
+      middle = (first + size) >> 1;
+      parse_idx_entry(rctx->buf + read_uint16(rctx->buf + ptr_pos + middle * 2)
+          + (is_leaf ? 0 : 4), &type_at, &val_at, &rowid_at);
+      int cmp = compare_rec_vals(type_at, val_at, col_type, val_data);
+      if (cmp < 0 || (cmp == 0 && rowid_at < min_rowid))
+        first = middle + 1;
+      else
+        size = middle;
+    }
+    uint16_t cell_pos = read_uint16(rctx->buf + ptr_pos + first * 2);
+    if (first < count) {
+      parse_idx_entry(rctx->buf + cell_pos + (is_leaf ? 0 : 4),
+          &type_at, &val_at, &found_rowid);
+      found = (compare_rec_vals(type_at, val_at, col_type, val_data) == 0);
+    }
+    if (!is_leaf)
+      page_no = read_uint32(rctx->buf + (first < count ? cell_pos : 8));
+  } while (!is_leaf);
+  if (!found)
+    return DBLOG_RES_NOT_FOUND;
+  return dblog_srch_row_by_id(rctx, found_rowid);
+}
+
 // See .h file for API description
 int dblog_upd_col_val(struct dblog_read_context *rctx, int col_idx, const void *val) {
   uint8_t *buf = rctx->buf;
+#if DBLOG_CFG_MMAP
+  if (rctx->map_base)
+    return DBLOG_RES_ERR;
+#endif
   if (buf[0] != 13)
     return DBLOG_RES_ERR;
   int16_t rec_count = read_uint16(rctx->buf + 3);
@@ -1509,12 +5657,26 @@ int dblog_upd_col_val(struct dblog_read_context *rctx, int col_idx, const void *
     return DBLOG_RES_NOT_FOUND;
   int len = dblog_derive_data_len(u32_at);
   write_data(val_at, derive_col_type(u32_at), val, len);
+  int32_t page_size = get_pagesize(rctx->page_size_exp);
+  uint16_t zone_len = zone_area_len(rctx->zone_col_count);
+  if (zone_len && read_uint16(buf + page_size - zone_len) == rec_count)
+    write_zones(buf, page_size, rctx->page_resv_bytes, NULL, rctx->zone_col_count);
   return DBLOG_RES_OK;
 }
 
 int dblog_write_cur_page(struct dblog_read_context *rctx, write_fn_def write_fn) {
+#if DBLOG_CFG_MMAP
+  if (rctx->map_base)
+    return DBLOG_RES_ERR; // buf points into the read only mapping
+#endif
   struct dblog_write_context wctx;
   wctx.buf = rctx->buf;
   wctx.write_fn = write_fn;
+#if DBLOG_CFG_READ_AHEAD
+  rctx->ahead_count = 0; // as it could have the page before update
+#endif
+#if DBLOG_CFG_FENCE_CACHE
+  rctx->fence_cache_used = 0;
+#endif
   return write_page(&wctx, rctx->cur_page, get_pagesize(rctx->page_size_exp));
 }
@@ -38,12 +38,134 @@
 //     and whether first record checksum matches during binary search
 #define DBLOG_CFG_READ_CHECKSUM 0
 
+// 0 - Full pages are written immediately using write_fn
+// 1 - Full pages are sealed and handed off to a queue of page buffers
+//     (wb_bufs) and written in the background, so appends do not
+//     wait for write_fn (see dblog_write_behind_drain())
+#ifndef DBLOG_CFG_WRITE_BEHIND
+#define DBLOG_CFG_WRITE_BEHIND 0
+#endif
+
+// Applicable only when DBLOG_CFG_WRITE_BEHIND is 1
+// 0 - Queue is drained by the application calling dblog_write_behind_drain()
+//     or when no free buffer is available for the next page
+// 1 - Queue is drained by a pthread worker (hosts such as Linux)
+// Either way, if write_async_fn is supplied, sealed pages are instead
+// handed to it as they are sealed (such as to start a DMA transfer)
+#ifndef DBLOG_CFG_WRITE_BEHIND_PTHREAD
+#define DBLOG_CFG_WRITE_BEHIND_PTHREAD 0
+#endif
+
+// 0 - Interior B-Tree pages are formed by dblog_finalize() reading
+//     the last rowid of every leaf page
+// 1 - Interior pages are formed as leaf pages are sealed, keeping one
+//     page per level in tree_buf and writing it (next to the leaf page)
+//     when it becomes full, so finalize only writes the right most pages
+//     Interior pages written before a power failure are put on the
+//     free list by dblog_recover(), in trunk pages after the new tree
+#ifndef DBLOG_CFG_STREAM_BTREE
+#define DBLOG_CFG_STREAM_BTREE 0
+#endif
+
+// 0 - Current page is flushed only by dblog_flush() or when full
+// 1 - dblog_group_commit() (called as rows are appended) flushes it
+//     when a limit in commit_policy is reached, and the last rowid
+//     flushed is kept in durable_rowid
+#ifndef DBLOG_CFG_GROUP_COMMIT
+#define DBLOG_CFG_GROUP_COMMIT 0
+#endif
+
+// 0 - dblog_flush() writes the current page in place
+// 1 - If page_resv_bytes is atleast 8, dblog_flush() writes the current
+//     page alternately in place and at a second slot (the next page,
+//     or the page after max pages for rolling logs), so that a torn
+//     write never destroys the last good copy. The page is written in
+//     place when it is sealed or partially finalized. Page no. and
+//     a sequence no. kept in the first 8 reserved bytes identify the
+//     latest copy during dblog_recover(). If the second slot is not
+//     overwritten by interior pages, dblog_finalize() puts it on the
+//     free list along with any pages before it
+#ifndef DBLOG_CFG_FLUSH_SLOTS
+#define DBLOG_CFG_FLUSH_SLOTS 0
+#endif
+
+// 0 - dblog_finalize() and dblog_recover() read leaf pages one by one
+// 1 - If finalize_threads is more than 1, last rowids of leaf pages
+//     are read by that many pthreads (hosts such as Linux) into
+//     leaf_rowids, and dblog_recover() scans for the last leaf page
+//     using them too. Interior pages formed are the same either way.
+//     read_fn is to be thread safe (such as using pread())
+#ifndef DBLOG_CFG_PARALLEL_FINALIZE
+#define DBLOG_CFG_PARALLEL_FINALIZE 0
+#endif
+
+// 0 - No partitioned scan
+// 1 - dblog_scan_partitions() scans ranges of leaf pages using
+//     a pthread (hosts such as Linux) and a read context for each.
+//     read_fn is to be thread safe (such as using pread())
+#ifndef DBLOG_CFG_PARALLEL_SCAN
+#define DBLOG_CFG_PARALLEL_SCAN 0
+#endif
+
+// 0 - Pages are read into buf of read context
+// 1 - Pages can be kept in cache_frames of read context so that
+//     repeated lookups read only the leaf page from the media
+#ifndef DBLOG_CFG_PAGE_CACHE
+#define DBLOG_CFG_PAGE_CACHE 0
+#endif
+
+// 0 - Pages are read using read_fn of read context
+// 1 - Database mapped into memory (map_base) can be read in place
+#ifndef DBLOG_CFG_MMAP
+#define DBLOG_CFG_MMAP 0
+#endif
+
+// 0 - Header of current row is decoded for each column read
+// 1 - Offsets and types of columns of current row can be kept in
+//     col_offsets and col_types of read context and reused
+#ifndef DBLOG_CFG_COL_CACHE
+#define DBLOG_CFG_COL_CACHE 0
+#endif
+
+// 0 - Leaf pages are read one by one when moving forward
+// 1 - Several pages can be read in one call into ahead_buf of read
+//     context and prefetch_fn told about pages to be read next
+#ifndef DBLOG_CFG_READ_AHEAD
+#define DBLOG_CFG_READ_AHEAD 0
+#endif
+
+// 0 - dblog_srch_row_by_id() searches the b-tree
+// 1 - If leaf pages have the same no. of rows, the writer records
+//     it in the first page and dblog_srch_row_by_id() reads the page
+//     having the Row ID directly, even if only partially finalized
+#ifndef DBLOG_CFG_PAGE_LAYOUT
+#define DBLOG_CFG_PAGE_LAYOUT 0
+#endif
+
+// 0 - Searches by value start from the whole range of leaf pages
+// 1 - Last values of leaf pages probed by searches can be kept in
+//     fence_cache of read context to narrow the range of later searches
+#ifndef DBLOG_CFG_FENCE_CACHE
+#define DBLOG_CFG_FENCE_CACHE 0
+#endif
+
+// 0 - Database has one table. Databases having more are not read
+// 1 - dblog_add_table() adds more tables to the database and
+//     table_idx of read context selects the table to be read
+#ifndef DBLOG_CFG_MULTI_TABLE
+#define DBLOG_CFG_MULTI_TABLE 0
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 #include <stdlib.h>
 #include <stdint.h>
+#if (DBLOG_CFG_WRITE_BEHIND && DBLOG_CFG_WRITE_BEHIND_PTHREAD) || DBLOG_CFG_PARALLEL_FINALIZE \
+      || DBLOG_CFG_PARALLEL_SCAN
+#include <pthread.h>
+#endif
 
 typedef unsigned char byte;
 
@@ -57,14 +179,39 @@ enum {DBLOG_RES_SEEK_ERR = -6, DBLOG_RES_READ_ERR = -7,
   DBLOG_RES_NOT_FOUND = -10, DBLOG_RES_NOT_FINALIZED = -11,
   DBLOG_RES_TYPE_MISMATCH = -12, DBLOG_RES_INV_CHKSUM = -13};
 
+struct dblog_write_context;
+
+#if DBLOG_CFG_GROUP_COMMIT
+// Group commit policy (see dblog_group_commit())
+// The current page is flushed and flush_fn called when any of the
+// following is reached since the last durable point. 0 means no limit
+struct dblog_commit_policy {
+  uint16_t max_rows;  // No. of rows appended
+  uint32_t max_bytes; // No. of bytes of records appended
+  uint32_t max_ticks; // Ticks elapsed as given by clock_fn
+  uint32_t (*clock_fn)(struct dblog_write_context *ctx); // Say millis()
+};
+#endif
+
+#if DBLOG_CFG_PARALLEL_FINALIZE
+// Last rowid of a leaf page read by a finalize thread
+struct dblog_leaf_rowid {
+  uint32_t rowid;
+  int8_t res;         // Result of reading it
+};
+#endif
+
 // Write context to be passed to create / append
-// a database.  The running values need not be supplied
+// a database.  Fields not used (such as optional ones) should be 0,
+// so the context is to be zeroed (say using memset()) before setting
+// fields. The running values need not be supplied
 struct dblog_write_context {
   byte *buf;          // working buffer of size page_size
   byte col_count;     // No. of columns (whether fits into page is not checked)
   byte page_size_exp; // 9=512, 10=1024 and so on upto 16=65536
   byte max_pages_exp; // Maximum data pages (as exponent of 2) after which
-                      //   to roll. 0 means no max. Not implemented yet.
+                      //   to roll over to first page. 0 means no max.
+                      //   Interior pages are formed after max pages
   byte page_resv_bytes; // Reserved bytes at end of every page (say checksum)
   // read_fn and write_fn should return no. of bytes read or written
   int32_t (*read_fn)(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len);
@@ -75,6 +222,102 @@ struct dblog_write_context {
   uint32_t cur_write_rowid;
   byte state;
   int err_no;
+  // Optional. Writes buf_count pages of page_len bytes from bufs
+  // contiguously starting at pos and returns total bytes written.
+  // Used instead of write_fn when more than one page is ready (NULL to
+  // always use write_fn)
+  int32_t (*writev_fn)(struct dblog_write_context *ctx, void **bufs,
+              byte buf_count, uint32_t pos, size_t page_len);
+#if DBLOG_CFG_WRITE_BEHIND
+  byte **wb_bufs;     // wb_buf_count buffers of size page_size, buf is made
+                      //   to point to one of them after init
+  byte wb_buf_count;  // No. of buffers in wb_bufs (atleast 2)
+  // Optional. Starts writing len bytes of buf at pos and returns 0
+  //   if started. dblog_write_complete() is to be called when each
+  //   write completes, in the order started. buf is not reused till then
+  int (*write_async_fn)(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len);
+  // Optional. Called repeatedly while waiting for such writes to
+  //   complete (say to sleep till the next interrupt). If not given,
+  //   the wait yields to other threads with DBLOG_CFG_WRITE_BEHIND_PTHREAD
+  //   and spins otherwise
+  void (*wait_fn)(struct dblog_write_context *ctx);
+#endif
+#if DBLOG_CFG_STREAM_BTREE
+  byte *tree_buf;     // tree_levels * page_size buffer for interior pages
+  byte tree_levels;   // Maximum levels of interior pages (say 4)
+#endif
+#if DBLOG_CFG_GROUP_COMMIT
+  struct dblog_commit_policy *commit_policy; // Optional group commit policy or NULL
+#endif
+  // Optional. 1 + index of a column having values in ascending order
+  //   (say timestamp) whose last value in every leaf page is written
+  //   by dblog_finalize() into a key directory after the interior
+  //   pages, so that searching it needs only a page or two of the
+  //   directory to be read to find the leaf page. 0 for none
+  //   Sqlite sees directory pages as free pages
+  byte key_dir_col;
+  // Optional. Buffer of (sort_buf_pages * page_size) bytes used by
+  //   dblog_finalize_with_index() to sort index entries and to form
+  //   index pages. Atleast 3 pages, allowing sort_buf_pages - 1 levels
+  //   NULL if dblog_finalize_with_index() is not used
+  byte *sort_buf;
+  byte sort_buf_pages;
+  // Optional. Indexes of zone_col_count columns (say readings) whose
+  //   min, max, sum and count of INT / REAL values are kept in the
+  //   last 2 + 28 * zone_col_count reserved bytes of every leaf page
+  //   when it becomes full, so readers can skip pages (see dblog_summary)
+  //   page_resv_bytes should be enough for them (and the slot mark
+  //   with DBLOG_CFG_FLUSH_SLOTS) and should not change on append
+  byte *zone_cols;
+  byte zone_col_count;
+#if DBLOG_CFG_PARALLEL_FINALIZE
+  struct dblog_leaf_rowid *leaf_rowids; // Buffer for last rowids of upto
+  uint32_t leaf_rowid_count; //   leaf_rowid_count leaf pages read at a time
+  byte finalize_threads;     // No. of threads reading them (say no. of cores)
+#endif
+  // following are more running values used internally
+  byte *schema_hdr;   // Record header template (see dblog_prepare_schema())
+  uint8_t *schema_types;
+  uint16_t *schema_lengths;
+  uint16_t schema_hdr_len;
+  uint16_t schema_rec_len;
+#if DBLOG_CFG_STREAM_BTREE
+  byte tree_depth;    // No. of interior levels formed so far
+#endif
+  uint16_t flushed_rec_count; // Records in current page when last flushed
+#if DBLOG_CFG_GROUP_COMMIT
+  uint32_t durable_rowid; // Last rowid written and flushed using flush_fn
+  uint32_t commit_bytes;  // Bytes of records appended since durable_rowid
+  uint32_t commit_tick;   // clock_fn value when durable_rowid was updated
+#endif
+#if DBLOG_CFG_FLUSH_SLOTS
+  uint32_t flush_seq; // Sequence no. of last copy of a page written
+  byte flush_slot;    // Where the last good copy of current page is
+#endif
+#if DBLOG_CFG_PAGE_LAYOUT
+  uint32_t layout_page;   // Leaf page from which every page sealed so far
+  uint32_t layout_rowid;  //   has layout_rows rows, starting at layout_rowid
+  uint16_t layout_rows;   //   (recorded in first page for direct lookup)
+#endif
+#if DBLOG_CFG_MULTI_TABLE
+  struct dblog_write_context *main_wctx; // First table, if this is another
+  struct dblog_write_context *next_table; //   (see dblog_add_table())
+  uint32_t last_page; // Last page used by any table, if more than one
+  byte table_idx;     // Row of table in schema table (0 for first table)
+  byte table_count;   // No. of tables (in context of first table)
+#endif
+#if DBLOG_CFG_WRITE_BEHIND
+  byte wb_cur;        // Index of buf in wb_bufs
+  byte wb_pending;    // No. of sealed pages yet to be written
+  byte wb_started;    // No. of async writes started (wraps around)
+  byte wb_completed;  // No. of async writes completed (wraps around)
+#if DBLOG_CFG_WRITE_BEHIND_PTHREAD
+  byte wb_running;
+  pthread_t wb_thread;
+  pthread_mutex_t wb_mutex;
+  pthread_cond_t wb_cond;
+#endif
+#endif
 };
 
 typedef int32_t (*write_fn_def)(struct dblog_write_context *ctx, void *buf, uint32_t pos, size_t len);
@@ -96,6 +339,32 @@ int dblog_write_init_with_script(struct dblog_write_context *wctx,
 // call dblog_finalize() to first finalize the database
 int dblog_init_for_append(struct dblog_write_context *wctx);
 
+#if DBLOG_CFG_MULTI_TABLE
+// Adds another table to the database being created using main_wctx,
+// to which rows are appended using the given context having its own
+// buf, col_count and zone_cols but sharing the file and the callbacks
+// (copied from main_wctx). To be called after dblog_write_init*() on
+// main_wctx and before appending rows to it. Upto 8 tables are possible.
+// Leaf pages of all tables follow one another in the order they are
+// started and the table of each is marked in the reserved byte before
+// zone maps, so page_resv_bytes should be atleast 1 more than that needed
+// for zone maps (zone_col_count should be the same for all tables).
+// Rolling logs (max_pages_exp), key_dir_col, index, DBLOG_CFG_STREAM_BTREE,
+// DBLOG_CFG_FLUSH_SLOTS and write-behind queue (other than write_async_fn)
+// are not used when there is more than one table.
+// Rows are to be appended to all tables from the same thread.
+// dblog_finalize() on main_wctx flushes all tables and forms their B-Trees
+// See table_idx of read context for reading other tables
+int dblog_add_table(struct dblog_write_context *wctx,
+      struct dblog_write_context *main_wctx, char *table_name, char *table_script);
+
+// Opens table_idx th table (1 for second table) of the database opened
+// using dblog_init_for_append() on main_wctx, for appending rows
+// using given context as with dblog_add_table()
+int dblog_init_table_for_append(struct dblog_write_context *wctx,
+      struct dblog_write_context *main_wctx, byte table_idx);
+#endif
+
 // Creates new record with all columns null
 // If no more space in page, writes it to disk
 // creates new page, and creates a new record
@@ -107,6 +376,31 @@ int dblog_append_empty_row(struct dblog_write_context *wctx);
 int dblog_append_row_with_values(struct dblog_write_context *wctx,
       uint8_t types[], const void *values[], uint16_t lengths[]);
 
+// Creates row_count new records in one call, packing as many as fit
+// into the current page at a time and updating the page header only
+// once per page. values[] and lengths[] have col_count entries per row,
+// one row after another (row-major). types[] applies to all rows.
+// If no more space in page, writes it to disk and continues in new page
+int dblog_append_rows(struct dblog_write_context *wctx, uint8_t types[],
+      const void *values[], uint16_t lengths[], int row_count);
+
+// Same as dblog_append_rows(), but values[] has one array per column
+// (column-major), each having row_count values of lengths[col] bytes
+// such as int32_t[] or fixed length timestamps.
+// NULL in col_values[] means the column is null in all rows
+int dblog_append_cols(struct dblog_write_context *wctx, uint8_t types[],
+      const void *col_values[], uint16_t lengths[], int row_count);
+
+// Prepares a fixed column layout so that the record header need not be
+// derived for every row appended. The serial types for given types[]
+// and lengths[] are stored in hdr_buf (atleast col_count * 3 bytes)
+// and copied as is for rows having the same layout. Rows having NULLs
+// or different lengths are appended the usual way.
+// To be called after dblog_write_init() or dblog_init_for_append()
+// types[], lengths[] and hdr_buf should remain valid till finalize
+int dblog_prepare_schema(struct dblog_write_context *wctx, uint8_t types[],
+      uint16_t lengths[], byte *hdr_buf);
+
 // Sets value of column in the current record for the given column index
 // If no more space in page, writes it to disk
 // creates new page, and moves the row to new page
@@ -122,10 +416,40 @@ const void *dblog_get_col_val(struct dblog_write_context *wctx, int col_idx, uin
 // Page is written only when it becomes full
 // If it needs to be written for each record or column,
 // this can be used
+// If the page was flushed before, only the header, new cell pointers
+// and changed records are written, unless writing full page is cheaper
 int dblog_flush(struct dblog_write_context *wctx);
 
+#if DBLOG_CFG_GROUP_COMMIT
+// Flushes if any of the limits in commit_policy is reached
+// Called after rows are appended, but can also be called from
+// idle loop so max_ticks is honoured when no rows are appended
+// durable_rowid of the write context has the last rowid flushed
+int dblog_group_commit(struct dblog_write_context *wctx);
+#endif
+
+#if DBLOG_CFG_WRITE_BEHIND
+// Writes pages sealed so far and waiting in the write-behind queue
+// If wait_all is 0, only the oldest page is written (say from idle loop)
+// With the pthread worker or write_async_fn, this waits till the queue
+// is empty if wait_all is 1
+// Returns no. of pages still pending or error
+int dblog_write_behind_drain(struct dblog_write_context *wctx, byte wait_all);
+
+// Writes all pending pages and stops the background worker, if any
+// Called by dblog_partial_finalize() and dblog_finalize()
+int dblog_write_behind_end(struct dblog_write_context *wctx);
+
+// To be called when a write started by write_async_fn completes
+// (such as from DMA completion interrupt or an IO thread)
+// written is the no. of bytes written
+void dblog_write_complete(struct dblog_write_context *wctx, int32_t written);
+#endif
+
 // Flushes data written so far and Updates the last leaf page number
 // in the first page to enable Binary Search
+// With DBLOG_CFG_STREAM_BTREE, also writes the right most interior pages
+// and root page number, so finalize need not read any leaf page
 int dblog_partial_finalize(struct dblog_write_context *wctx);
 
 // Based on the data written so far, forms Interior B-Tree pages
@@ -133,6 +457,14 @@ int dblog_partial_finalize(struct dblog_write_context *wctx);
 // in the first page.
 int dblog_finalize(struct dblog_write_context *wctx);
 
+// Finalizes like dblog_finalize() and also creates index on given
+// column as though CREATE INDEX was run, so that rows can be looked up
+// using dblog_srch_by_index(). Values and rowids are sorted in runs
+// using sort_buf and merged using scratch pages after the table,
+// which are left as free pages. Values longer than about a quarter
+// of a page cannot be indexed (DBLOG_RES_TOO_LONG)
+int dblog_finalize_with_index(struct dblog_write_context *wctx, int col_idx);
+
 // Returns 1 if the database is in unfinalized state
 int dblog_not_finalized(struct dblog_write_context *wctx);
 
@@ -143,8 +475,35 @@ int32_t dblog_read_page_size(struct dblog_write_context *wctx);
 // and finalizes it
 int dblog_recover(struct dblog_write_context *wctx);
 
+#if DBLOG_CFG_PAGE_CACHE
+// Frame of page cache of read context
+struct dblog_cache_frame {
+  byte *buf;          // buffer of size page_size
+  // following are running values used internally
+  uint32_t page_no;
+  uint32_t last_used;
+};
+#endif
+
+// Max. length of values remembered in fence cache of read context
+#define DBLOG_FENCE_VAL_LEN 24
+
+#if DBLOG_CFG_FENCE_CACHE
+// Last value of a leaf page found during search by value
+struct dblog_fence {
+  uint32_t leaf_no;     // n-th leaf page from first leaf page
+  uint32_t page_no;
+  uint32_t last_used;
+  uint32_t col_type;    // Row ID if col_idx is -1
+  uint16_t rec_pos;
+  int16_t col_idx;
+  byte val[DBLOG_FENCE_VAL_LEN];
+};
+#endif
+
 // Read context to be passed to read from a database created using this library.
-// The running values need not be supplied
+// Fields not used (such as optional ones) should be 0, so the context is
+// to be zeroed before setting fields. The running values need not be supplied
 struct dblog_read_context {
   byte *buf;
   // read_fn should return no. of bytes read
@@ -156,12 +515,107 @@ struct dblog_read_context {
   uint16_t cur_rec_pos;
   byte page_size_exp;
   byte page_resv_bytes;
+#if DBLOG_CFG_PAGE_CACHE
+  // Optional page cache. Pages are read into these frames and buf is
+  //   made to point to the frame having current page. Least recently
+  //   used leaf pages are evicted before interior pages
+  struct dblog_cache_frame *cache_frames;
+  byte cache_frame_count;
+#endif
+#if DBLOG_CFG_MMAP
+  // Optional. Database mapped into memory (say using mmap()). If given,
+  //   pages are accessed in place without read_fn or copying, buf is
+  //   made to point into the mapping and values returned point into it
+  //   The mapping is only read, so dblog_upd_col_val() and
+  //   dblog_write_cur_page() return DBLOG_RES_ERR when it is given
+  const byte *map_base;
+  uint32_t map_len;
+#endif
+#if DBLOG_CFG_COL_CACHE
+  // Optional. Offsets and types of columns of current row are decoded
+  //   once into these (col_cache_len entries each) and reused by
+  //   dblog_read_col_val() till the cursor moves to another row
+  uint16_t *col_offsets;
+  uint32_t *col_types;
+  byte col_cache_len;
+#endif
+#if DBLOG_CFG_READ_AHEAD
+  // Optional. Buffer of (ahead_page_count * page_size) bytes into which
+  //   that many pages are read in one call when moving forward
+  //   to a leaf page not already read ahead
+  byte *ahead_buf;
+  byte ahead_page_count;
+  // Optional. Called with position and length of pages to be read
+  //   next when moving forward, so that they can be fetched in advance
+  void (*prefetch_fn)(struct dblog_read_context *ctx, uint32_t pos, size_t len);
+#endif
+#if DBLOG_CFG_FENCE_CACHE
+  // Optional. Last values of leaf pages probed by searches are kept
+  //   here, sorted by column and page, so that later searches start
+  //   from a narrower range of pages. Least recently used are replaced
+  struct dblog_fence *fence_cache;
+  byte fence_cache_len;
+#endif
+#if DBLOG_CFG_MULTI_TABLE
+  // Optional. Table to be read (its row in schema table, 0 for first)
+  //   when the database has more than one table (see dblog_add_table())
+  byte table_idx;
+#endif
+  // following are more running values used internally
+  uint32_t first_leaf_page; // Other than 1 if leaf pages have rolled over
+  byte max_pages_exp;
+#if DBLOG_CFG_PAGE_CACHE || DBLOG_CFG_FENCE_CACHE
+  uint32_t cache_tick;
+#endif
+#if DBLOG_CFG_COL_CACHE
+  byte *col_cache_buf;  // buf, page and row for which columns are decoded
+  uint32_t col_cache_page;
+  uint16_t col_cache_rec_pos;
+  int16_t col_cache_count; // No. of columns in decoded row or -1 if corrupt
+#endif
+#if DBLOG_CFG_READ_AHEAD
+  uint32_t ahead_page;  // first page in ahead_buf
+  byte ahead_count;     // no. of pages in ahead_buf
+#endif
+#if DBLOG_CFG_PAGE_LAYOUT
+  uint32_t layout_page;  // Leaf page layout recorded by writer
+  uint32_t layout_rowid; //   (see dblog_srch_row_by_id())
+  uint16_t layout_rows;
+#endif
+#if DBLOG_CFG_FENCE_CACHE
+  byte fence_cache_used;
+#endif
+  byte key_dir_col;      // Key directory written by finalize, if any
+  byte key_dir_entry_len;
+  uint32_t key_dir_page;
+  uint32_t index_root;   // Root page of index, read when needed
+  byte zone_col_count;   // No. of columns having zone maps
+#if DBLOG_CFG_MULTI_TABLE
+  byte table_count;      // No. of tables in the database
+#endif
+};
+
+// Summary of values of a column in a leaf page (zone map, see zone_cols
+// of write context) or in a range of rows (see dblog_aggregate())
+// Only INT and REAL values are summarized. min_int, max_int and
+// sum_int are valid only if none of them is REAL
+struct dblog_summary {
+  uint32_t count;     // No. of INT and REAL values
+  byte is_real;
+  int64_t min_int;
+  int64_t max_int;
+  int64_t sum_int;    // Wraps around on overflow
+  double min;
+  double max;
+  double sum;
 };
 
 // Reads a database created using this library,
 // checks signature and positions at the first record.
 // Cannot be used to read SQLite databases
 // not created using this library or modified using other libraries
+// Returns DBLOG_RES_ERR if the database has more than one table
+// unless DBLOG_CFG_MULTI_TABLE is 1
 int dblog_read_init(struct dblog_read_context *rctx);
 
 // Returns number of columns in the current record
@@ -174,6 +628,28 @@ int dblog_cur_row_col_count(struct dblog_read_context *rctx);
 // to get the actual length
 const void *dblog_read_col_val(struct dblog_read_context *rctx, int col_idx, uint32_t *out_col_type);
 
+// Column to be decoded by dblog_decode_page_columns()
+// values should have room for max_rows entries of int64_t for
+// DBLOG_TYPE_INT, double for DBLOG_TYPE_REAL and const byte *
+// pointing to the data for DBLOG_TYPE_BLOB and DBLOG_TYPE_TEXT
+// along with their lengths in lens, if given
+// Bit n of nulls is set if row n has NULL, no value
+// or value of another type for the column
+struct dblog_col_array {
+  int col_idx;
+  int type;
+  void *values;
+  uint16_t *lens;
+  byte *nulls;
+};
+
+// Decodes given columns of records from current position to end of
+// current page into the arrays, at most max_rows of them
+// Returns number of rows decoded and positions at the last of them
+// so that dblog_read_next_row() moves to the next page
+int dblog_decode_page_columns(struct dblog_read_context *rctx,
+      struct dblog_col_array *cols, byte col_count, uint16_t max_rows);
+
 // For text and blob columns, pass the out_col_type
 // returned by dblog_read_col_val() to get the actual length
 uint32_t dblog_derive_data_len(uint32_t col_type);
@@ -195,6 +671,9 @@ int dblog_read_last_row(struct dblog_read_context *rctx);
 // Performs binary search on the inserted records
 // using the given Row ID and positions at the record found
 // Does not change position if record not found
+// With DBLOG_CFG_PAGE_LAYOUT, if leaf pages have the same no. of rows,
+// the page having the Row ID is computed and read directly, without
+// searching the tree and even if the database was only partially finalized
 int dblog_srch_row_by_id(struct dblog_read_context *rctx, uint32_t rowid);
 
 // Performs binary search on the inserted records
@@ -204,9 +683,88 @@ int dblog_srch_row_by_id(struct dblog_read_context *rctx, uint32_t rowid);
 int dblog_bin_srch_row_by_val(struct dblog_read_context *rctx, int col_idx,
       int val_type, void *val, uint16_t len, byte is_rowid);
 
+// Same as dblog_bin_srch_row_by_val(), but probes leaf pages where the
+// value is estimated to be, by interpolating between the values found
+// so far, falling back to bisection when estimates are poor
+// Needs far fewer reads when values are nearly uniformly spaced
+// Interpolation is done for INT, REAL, Row ID and ISO-8601 timestamps
+// in TEXT columns (YYYY-MM-DD HH:MM:SS.SSS)
+int dblog_interp_srch_row_by_val(struct dblog_read_context *rctx, int col_idx,
+      int val_type, void *val, uint16_t len, byte is_rowid);
+
+// Positions at first record having value of given column (or Row ID
+// if is_rowid = 1) not less than lo and calls row_fn for it and
+// following records till value exceeds hi or row_fn returns non-zero
+// Values are read using dblog_read_col_val() from within row_fn
+// Pages are read ahead if ahead_buf is given (DBLOG_CFG_READ_AHEAD)
+// Returns what row_fn returned if non-zero
+int dblog_scan_range(struct dblog_read_context *rctx, int col_idx, int val_type,
+      void *lo, uint16_t lo_len, void *hi, uint16_t hi_len, byte is_rowid,
+      int (*row_fn)(struct dblog_read_context *ctx));
+
+// Same as dblog_scan_range(), but calls row_fn only for records having
+// a number between flo and fhi (inclusive) in column filter_col
+// Leaf pages whose zone map of filter_col shows no such number are
+// skipped by reading only their zone map and not the whole page
+int dblog_scan_range_where(struct dblog_read_context *rctx, int col_idx,
+      int val_type, void *lo, uint16_t lo_len, void *hi, uint16_t hi_len,
+      byte is_rowid, int filter_col, double flo, double fhi,
+      int (*row_fn)(struct dblog_read_context *ctx));
+
+// Reads zone map of given column of the current page into out_zone
+// Returns DBLOG_RES_NOT_FOUND if there is none, such as for the last
+// page, which is summarized only when full
+int dblog_read_zone(struct dblog_read_context *rctx, int col_idx,
+      struct dblog_summary *out_zone);
+
+// Summarizes values of column col_idx (count, min, max and sum
+// for average) in records having value of key_col (or Row ID if
+// is_rowid = 1) between lo and hi, found using binary search
+// lo and hi can be NULL to start from first or end at last record
+// Pages entirely in the range are summarized using their zone maps,
+// if any (see zone_cols), reading only the zone maps
+int dblog_aggregate(struct dblog_read_context *rctx, int key_col, int val_type,
+      void *lo, uint16_t lo_len, void *hi, uint16_t hi_len, byte is_rowid,
+      int col_idx, struct dblog_summary *out_sum);
+
+// Same as dblog_aggregate(), but summarizes values separately for
+// buckets of key_col values, each bucket_width wide starting from
+// multiples of it (such as 60 for minutes) and calls bucket_fn with
+// start of the bucket and its summary for each bucket having values
+// key_col can have INT, REAL or ISO-8601 timestamps (as seconds)
+// Returns what bucket_fn returned if non-zero
+int dblog_bucketize(struct dblog_read_context *rctx, int key_col, int val_type,
+      void *lo, uint16_t lo_len, void *hi, uint16_t hi_len, int col_idx,
+      double bucket_width, int (*bucket_fn)(struct dblog_read_context *ctx,
+                             double bucket, struct dblog_summary *sum));
+
+#if DBLOG_CFG_PARALLEL_SCAN
+// Divides leaf pages of a finalized database into part_count ranges
+// and calls row_fn for each row of the table being read, rows of each
+// range in order from a thread of its own using rctxs[i] for range i
+// Each read context should be set up as for dblog_read_init() with
+// its own buf (and other buffers if any). It is initialized here
+// After all threads finish, reduce_fn (if not NULL) is called in the
+// calling thread for each range in order, to merge its results
+// A range stops when row_fn returns non-zero, which is returned
+// Returns what reduce_fn returned if non-zero
+int dblog_scan_partitions(struct dblog_read_context *rctxs, byte part_count,
+      int (*row_fn)(struct dblog_read_context *ctx),
+      int (*reduce_fn)(struct dblog_read_context *ctx, byte part));
+#endif
+
+// Looks up index formed by dblog_finalize_with_index() and positions
+// at the row having given value, with least rowid not less than min_rowid
+// Pass 0 as min_rowid for the first such row and 1 + its rowid for next
+// Returns DBLOG_RES_NOT_FOUND if no such row or if there is no index
+int dblog_srch_by_index(struct dblog_read_context *rctx, int val_type,
+      void *val, uint16_t len, uint32_t min_rowid);
+
 // Updates value of column at current position
 // For text and blob columns, pass the type to dblog_derive_data_len()
 // to get the actual length
+// Zone maps of the page, if any, are formed again
+// Returns DBLOG_RES_ERR if the database is mapped (map_base)
 int dblog_upd_col_val(struct dblog_read_context *rctx, int col_idx, const void *val);
 
 // Writes the current page to disk